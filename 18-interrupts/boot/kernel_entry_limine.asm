@@ -1,18 +1,20 @@
 [bits 32]
 [global _start]
 
-extern kernel_main
+extern main
 extern multiboot2_info
+extern multiboot2_magic
 
 _start:
-    ; Save multiboot2 info
-    mov [multiboot2_info], esi
+    ; Save multiboot2 info: eax holds the loader magic, ebx the info address
+    mov [multiboot2_magic], eax
+    mov [multiboot2_info], ebx
     
     ; Set up stack
     mov esp, stack_top
     
     ; Call kernel main
-    call kernel_main
+    call main
     
     ; Infinite loop if kernel returns
     cli
@@ -24,6 +26,3 @@ align 4
 stack_bottom:
     resb 16384  ; 16 KB stack
 stack_top:
-
-section .data
-multiboot2_info: dd 0 
\ No newline at end of file
@@ -0,0 +1,220 @@
+/* Host-side IPC microbenchmark.
+ *
+ * Builds kernel/ipc.c and the kernel heap (libc/mem.c) for the host and
+ * times the message paths in nanoseconds per operation. Results go to
+ * stdout as CSV:
+ *
+ *   benchmark,queue_depth,receivers,payload_bytes,iterations,ns_per_op
+ *
+ * Usage: ipc_bench [operations per case]
+ *
+ * Each case runs in batches: fill the queue to 'queue_depth' messages,
+ * then drain it, timing the two halves separately. The cost of reading
+ * the clock is measured once and subtracted from every batch. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../kernel/ipc.h"
+#include "../libc/mem.h"
+
+#define DEFAULT_OPERATIONS 200000
+
+#define SENDER_PID   1
+#define RECEIVER_PID 2
+
+static const u32 depths[] = { 1, 4, 16 };
+static const u32 payloads[] = { 0, 16, 64, 256 };
+static const u32 receiver_counts[] = { 1, 8, 64 };
+static const u32 buffer_sizes[] = { 4096, 65536, 1048576 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static u32 operations = DEFAULT_OPERATIONS;
+static long long clock_overhead = 0;
+static u8 payload[IPC_MAX_MESSAGE_SIZE];
+static ipc_message_t message;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Time between two back-to-back clock reads, best of many */
+static void calibrate_clock(void) {
+    long long best = -1;
+    for (int i = 0; i < 10000; i++) {
+        long long t0 = now_ns();
+        long long t1 = now_ns();
+        if (best < 0 || t1 - t0 < best) best = t1 - t0;
+    }
+    clock_overhead = best;
+}
+
+static long long elapsed_since(long long start) {
+    long long ns = now_ns() - start - clock_overhead;
+    return ns > 0 ? ns : 0;
+}
+
+static void report(const char *name, u32 depth, u32 receivers, u32 bytes,
+                   u32 iterations, long long total_ns) {
+    printf("%s,%u,%u,%u,%u,%.1f\n", name, depth, receivers, bytes, iterations,
+           iterations ? (double)total_ns / iterations : 0.0);
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "ipc_bench: %s failed\n", what);
+    exit(1);
+}
+
+/* Fresh IPC state for the next case: every test process gets one queue */
+static void setup_processes(u32 first_pid, u32 count, u32 depth) {
+    for (u32 pid = first_pid; pid < first_pid + count; pid++) {
+        if (!ipc_create_queue(pid, depth)) fail("ipc_create_queue");
+    }
+}
+
+static void teardown_processes(u32 first_pid, u32 count) {
+    for (u32 pid = first_pid; pid < first_pid + count; pid++) {
+        ipc_cleanup_process(pid);
+    }
+}
+
+/* Plain and prioritised send/receive through one queue of 'depth' slots */
+static void bench_send_receive(u32 depth, u32 bytes, int prioritised) {
+    setup_processes(SENDER_PID, 2, depth);
+
+    u32 batches = operations / depth;
+    long long send_ns = 0, receive_ns = 0;
+    for (u32 b = 0; b < batches; b++) {
+        long long start = now_ns();
+        for (u32 i = 0; i < depth; i++) {
+            u32 ok = prioritised
+                ? ipc_send_with_priority(SENDER_PID, RECEIVER_PID, 1, payload, bytes,
+                                         IPC_PRIORITY_LOW + (i & 3))
+                : ipc_send_message(SENDER_PID, RECEIVER_PID, 1, payload, bytes);
+            if (!ok) fail("send");
+        }
+        send_ns += elapsed_since(start);
+
+        start = now_ns();
+        for (u32 i = 0; i < depth; i++) {
+            if (!ipc_receive_message(RECEIVER_PID, &message)) fail("receive");
+        }
+        receive_ns += elapsed_since(start);
+    }
+
+    u32 iterations = batches * depth;
+    report(prioritised ? "send_priority" : "send", depth, 1, bytes, iterations, send_ns);
+    report(prioritised ? "receive_priority" : "receive", depth, 1, bytes, iterations, receive_ns);
+
+    teardown_processes(SENDER_PID, 2);
+}
+
+/* One broadcast reaches every registered process but the sender; the
+ * receivers are drained outside the timed region */
+static void bench_broadcast(u32 receivers, u32 bytes) {
+    setup_processes(SENDER_PID, receivers + 1, 1);
+
+    u32 iterations = operations / receivers;
+    if (iterations == 0) iterations = 1;
+    long long total_ns = 0;
+    for (u32 n = 0; n < iterations; n++) {
+        long long start = now_ns();
+        if (ipc_broadcast_message(SENDER_PID, 1, payload, bytes) != receivers) {
+            fail("ipc_broadcast_message");
+        }
+        total_ns += elapsed_since(start);
+
+        for (u32 pid = SENDER_PID + 1; pid <= SENDER_PID + receivers; pid++) {
+            ipc_receive_message(pid, &message);
+        }
+    }
+    report("broadcast", 1, receivers, bytes, iterations, total_ns);
+
+    teardown_processes(SENDER_PID, receivers + 1);
+}
+
+/* A create/delete pair on a process that already has an IPC entry */
+static void bench_queue_lifecycle(u32 depth) {
+    setup_processes(SENDER_PID, 1, depth);
+
+    long long total_ns = 0;
+    long long start = now_ns();
+    for (u32 n = 0; n < operations; n++) {
+        u32 queue_id = ipc_create_queue(SENDER_PID, depth);
+        if (!queue_id || !ipc_delete_queue(queue_id)) fail("queue create/delete");
+    }
+    total_ns = elapsed_since(start);
+    report("queue_create_delete", depth, 1, 0, operations, total_ns);
+
+    teardown_processes(SENDER_PID, 1);
+}
+
+/* Zero-copy: one buffer handed back and forth, each leg a send plus the
+ * matching receive. Cost should not depend on the buffer size */
+static void bench_buffer_handoff(u32 size) {
+    setup_processes(SENDER_PID, 2, 1);
+
+    u32 handle = ipc_buffer_alloc(SENDER_PID, size);
+    if (!handle) fail("ipc_buffer_alloc");
+
+    u32 from = SENDER_PID, to = RECEIVER_PID;
+    long long start = now_ns();
+    for (u32 n = 0; n < operations; n++) {
+        if (!ipc_send_buffer(from, to, 1, handle, size, IPC_PRIORITY_NORMAL) ||
+            !ipc_receive_message(to, &message) || message.buffer != handle) {
+            fail("buffer handoff");
+        }
+        u32 swap = from;
+        from = to;
+        to = swap;
+    }
+    long long total_ns = elapsed_since(start);
+    report("buffer_handoff", 1, 1, size, operations, total_ns);
+
+    ipc_buffer_free(from, handle);
+    teardown_processes(SENDER_PID, 2);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        operations = (u32)strtoul(argv[1], 0, 0);
+        if (operations == 0) {
+            fprintf(stderr, "usage: %s [operations per case]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (u32 i = 0; i < sizeof(payload); i++) payload[i] = (u8)i;
+
+    init_kernel_heap();
+    init_ipc_system();
+    calibrate_clock();
+
+    printf("benchmark,queue_depth,receivers,payload_bytes,iterations,ns_per_op\n");
+
+    for (u32 d = 0; d < COUNT(depths); d++) {
+        for (u32 p = 0; p < COUNT(payloads); p++) {
+            bench_send_receive(depths[d], payloads[p], 0);
+        }
+    }
+    for (u32 d = 0; d < COUNT(depths); d++) {
+        for (u32 p = 0; p < COUNT(payloads); p++) {
+            bench_send_receive(depths[d], payloads[p], 1);
+        }
+    }
+    for (u32 r = 0; r < COUNT(receiver_counts); r++) {
+        for (u32 p = 0; p < COUNT(payloads); p++) {
+            bench_broadcast(receiver_counts[r], payloads[p]);
+        }
+    }
+    for (u32 d = 0; d < COUNT(depths); d++) {
+        bench_queue_lifecycle(depths[d]);
+    }
+    for (u32 s = 0; s < COUNT(buffer_sizes); s++) {
+        bench_buffer_handoff(buffer_sizes[s]);
+    }
+
+    return 0;
+}
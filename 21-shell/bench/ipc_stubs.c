@@ -0,0 +1,103 @@
+/* Host stand-ins for the kernel services kernel/ipc.c and libc/mem.c
+ * link against. Everything IPC would get from the scheduler, the
+ * paging code or the screen is reduced to the cheapest thing that keeps
+ * the IPC logic on its normal path, so the numbers measure IPC work.
+ *
+ * The kernel keeps pointers in u32, so all memory handed to kernel code
+ * comes from below 4GB (MAP_32BIT). */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "../cpu/types.h"
+#include "../cpu/isr.h"
+#include "../cpu/paging.h"
+#include "../cpu/timer.h"
+#include "../cpu/clock.h"
+#include "../kernel/memory.h"
+#include "../kernel/pmm.h"
+#include "../kernel/process.h"
+#include "../kernel/klog.h"
+
+/* Every benchmark process is a kernel process: zero-copy buffers are
+ * reached through the identity map, no page tables are touched */
+static u32 kernel_pd[1];
+u32 *kernel_directory = kernel_pd;
+
+u32 tick = 0;
+
+static process_t bench_process;
+static u32 alloc_low(u32 bytes) {
+    void *p = mmap(0, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    return p == MAP_FAILED ? 0 : (u32)(unsigned long)p;
+}
+
+/* Scheduler */
+/* Pid 0 never owns a queue, so receives poll instead of sleeping */
+int get_current_pid(void) { return 0; }
+
+process_t *get_process(int pid) {
+    if (pid < 0) return 0;
+    bench_process.pid = pid;
+    bench_process.state = PROCESS_RUNNING;
+    bench_process.privileges = PRIVILEGE_KERNEL;
+    bench_process.page_directory = kernel_directory;
+    return &bench_process;
+}
+
+void block_process(int pid) { (void)pid; }
+void unblock_process(int pid) { (void)pid; }
+void boost_process(int pid, int level) { (void)pid; (void)level; }
+void wait_until_unblocked(void) { }
+
+/* Timer wheel */
+void timer_add(ktimer_t *timer, u32 ticks, void (*callback)(void *data), void *data) {
+    (void)timer; (void)ticks; (void)callback; (void)data;
+}
+void timer_cancel(ktimer_t *timer) { (void)timer; }
+u32 timer_ms_to_ticks(u32 ms) { return ms; }
+
+/* Clocksource: the host's monotonic clock */
+u64 ktime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * NSEC_PER_SEC + (u64)ts.tv_nsec;
+}
+u64 div_u64(u64 dividend, u32 divisor, u32 *remainder) {
+    if (remainder) *remainder = (u32)(dividend % divisor);
+    return dividend / divisor;
+}
+
+/* Physical memory: the real slab allocator (libc/mem.c) runs on top */
+u32 pmm_alloc_frames(u32 count) { return alloc_low(count * 0x1000); }
+void pmm_free_frames(u32 addr, u32 count) { munmap((void*)(unsigned long)addr, count * 0x1000); }
+
+/* Paging and VMAs, only reached for user processes */
+int paging_map_page(u32 *dir, u32 virt, u32 phys, u32 flags) {
+    (void)dir; (void)virt; (void)phys; (void)flags;
+    return 1;
+}
+u32 paging_unmap_page(u32 *dir, u32 virt) { (void)dir; (void)virt; return 0; }
+u32 find_free_range(int pid, u32 base, u32 limit, u32 size) {
+    (void)pid; (void)limit; (void)size;
+    return base;
+}
+int allocate_memory_region(u32 start, u32 size, int permissions, int pid, int type) {
+    (void)start; (void)size; (void)permissions; (void)pid; (void)type;
+    return 0;
+}
+void free_memory_region(int region_id) { (void)region_id; }
+
+/* Output */
+void kprint(char *message) { (void)message; }
+void klog_write(int level, char *format, ...) { (void)level; (void)format; }
+void int_to_ascii(int n, char str[]) { sprintf(str, "%d", n); }
+
+/* The kernel's memset takes an int size; keep it off libc's */
+void bench_memset(void *ptr, int value, int size) { memset(ptr, value, (size_t)size); }
+
+/* Single threaded: nothing to mask */
+u32 irq_save(void) { return 0; }
+void irq_restore(u32 eflags) { (void)eflags; }
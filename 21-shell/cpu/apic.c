@@ -0,0 +1,224 @@
+#include "apic.h"
+#include "idt.h"
+#include "pic.h"
+#include "paging.h"
+#include "timer.h"
+#include "clock.h"
+#include "../kernel/acpi.h"
+#include "../kernel/klog.h"
+#include "../libc/function.h"
+
+/* Local APIC registers, offsets into its MMIO page */
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LVT_MASKED          0x10000
+#define LVT_TIMER_PERIODIC  0x20000
+#define TIMER_DIVIDE_BY_16  0x3
+
+#define MSR_APIC_BASE        0x1B
+#define MSR_APIC_BASE_ENABLE 0x800
+#define CPUID_APIC           (1u << 9)
+
+/* IOAPIC: an index register and a data window */
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VERSION  0x01
+#define IOAPIC_REDIRECT 0x10  /* Two registers per input */
+
+#define REDIRECT_ACTIVE_LOW 0x2000
+#define REDIRECT_LEVEL      0x8000
+#define REDIRECT_MASKED     0x10000
+
+static volatile u32 *lapic = 0;
+
+/* Where each IRQ line enters an IOAPIC; address 0 when not routed */
+typedef struct {
+    u32 ioapic;
+    u32 pin;
+} irq_route_t;
+
+static irq_route_t routes[IRQ_LINES];
+
+static u32 lapic_read(u32 reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(u32 reg, u32 value) {
+    lapic[reg / 4] = value;
+}
+
+static u32 ioapic_read(u32 base, u32 reg) {
+    *(volatile u32*)(base + IOAPIC_REGSEL) = reg;
+    return *(volatile u32*)(base + IOAPIC_WINDOW);
+}
+
+static void ioapic_write(u32 base, u32 reg, u32 value) {
+    *(volatile u32*)(base + IOAPIC_REGSEL) = reg;
+    *(volatile u32*)(base + IOAPIC_WINDOW) = value;
+}
+
+/* One MMIO write, no port I/O */
+static void apic_eoi(u32 irq) {
+    UNUSED(irq);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void apic_set_mask(u32 irq, int masked) {
+    if (irq >= IRQ_LINES || !routes[irq].ioapic) return;
+    u32 reg = IOAPIC_REDIRECT + routes[irq].pin * 2;
+    u32 low = ioapic_read(routes[irq].ioapic, reg);
+    ioapic_write(routes[irq].ioapic, reg, masked ? (low | REDIRECT_MASKED) : (low & ~REDIRECT_MASKED));
+}
+
+static void apic_mask(u32 irq) {
+    apic_set_mask(irq, 1);
+}
+
+static void apic_unmask(u32 irq) {
+    apic_set_mask(irq, 0);
+}
+
+irq_chip_t apic_chip = { "IOAPIC", apic_eoi, apic_mask, apic_unmask };
+
+/* IOAPIC input for a global system interrupt */
+static int find_input(acpi_madt_info_t *madt, u32 gsi, irq_route_t *route) {
+    for (u32 i = 0; i < madt->ioapic_count; i++) {
+        acpi_ioapic_t *ioapic = &madt->ioapics[i];
+        u32 inputs = ((ioapic_read(ioapic->address, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        if (gsi >= ioapic->gsi_base && gsi < ioapic->gsi_base + inputs) {
+            route->ioapic = ioapic->address;
+            route->pin = gsi - ioapic->gsi_base;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Is 'gsi' taken by an ISA IRQ other than 'irq' through an override
+ * (like the PIT on GSI 2, where the cascade used to be)? */
+static int gsi_overridden(acpi_madt_info_t *madt, u32 gsi, u32 irq) {
+    for (u32 other = 0; other < ACPI_ISA_IRQS; other++) {
+        if (other != irq && madt->isa_gsi[other] == gsi && gsi != other) return 1;
+    }
+    return 0;
+}
+
+/* Program one IOAPIC input for 'irq', masked until a handler opens it */
+static void route_irq(acpi_madt_info_t *madt, u32 irq, u32 gsi, u32 flags, u32 apic_id) {
+    irq_route_t route;
+    if (!find_input(madt, gsi, &route)) return;
+
+    u32 low = (IRQ0 + irq) | REDIRECT_MASKED;
+    if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) low |= REDIRECT_ACTIVE_LOW;
+    if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) low |= REDIRECT_LEVEL;
+
+    u32 reg = IOAPIC_REDIRECT + route.pin * 2;
+    ioapic_write(route.ioapic, reg + 1, apic_id << 24);
+    ioapic_write(route.ioapic, reg, low);
+    routes[irq] = route;
+}
+
+int init_apic(void) {
+    u32 eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & CPUID_APIC)) return 0;
+
+    acpi_madt_info_t madt;
+    if (!acpi_parse_madt(&madt)) return 0;
+
+    /* The registers live in the kernel MMIO window; this runs before
+     * any process directory exists */
+    if (!paging_map_mmio(madt.lapic_address, PAGE_SIZE)) return 0;
+    for (u32 i = 0; i < madt.ioapic_count; i++) {
+        if (!paging_map_mmio(madt.ioapics[i].address, IOAPIC_WINDOW + 4)) return 0;
+    }
+
+    u32 flags = irq_save();
+
+    /* Enable the local APIC (globally, then in software) */
+    u32 low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(MSR_APIC_BASE));
+    asm volatile("wrmsr" : : "c"(MSR_APIC_BASE), "a"(low | MSR_APIC_BASE_ENABLE), "d"(high));
+    lapic = (volatile u32*)madt.lapic_address;
+    set_idt_gate(APIC_SPURIOUS_VECTOR, (u32)apic_spurious_stub);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);  /* No virtual wire to the PIC */
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+
+    /* ISA IRQs (with their overrides), then the PCI inputs beyond them */
+    u32 apic_id = lapic_read(LAPIC_ID) >> 24;
+    for (u32 irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        u32 gsi = madt.isa_gsi[irq];
+        if (!gsi_overridden(&madt, gsi, irq)) {
+            route_irq(&madt, irq, gsi, madt.isa_flags[irq], apic_id);
+        }
+    }
+    for (u32 irq = ACPI_ISA_IRQS; irq < IRQ_LINES; irq++) {
+        if (!gsi_overridden(&madt, irq, irq)) {
+            route_irq(&madt, irq, irq, ACPI_POLARITY_LOW | ACPI_TRIGGER_LEVEL, apic_id);
+        }
+    }
+
+    pic_disable();
+    irq_chip = &apic_chip;
+    irq_restore(flags);
+
+    klog_info("APIC: local APIC %u, %u IOAPICs, PIC masked", apic_id, madt.ioapic_count);
+    return 1;
+}
+
+/* Local APIC timer as the tick source */
+static void apic_timer_periodic(u32 count) {
+    lapic_write(LAPIC_LVT_TIMER, IRQ0 | LVT_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+static void apic_timer_oneshot(u32 count) {
+    lapic_write(LAPIC_LVT_TIMER, IRQ0);
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+static u32 apic_timer_read_count(void) {
+    return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+static timer_source_t apic_timer_source = {
+    "local APIC", 0, 0xFFFFFFFF, apic_timer_periodic, apic_timer_oneshot, apic_timer_read_count
+};
+
+int init_apic_timer(void) {
+    if (!lapic || !clock_tsc_khz()) return 0;
+
+    /* Count down from the top for a while, timed by the clocksource */
+    u32 flags = irq_save();
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    u64 end = ktime_ns() + (u64)APIC_TIMER_CALIBRATE_MS * NSEC_PER_MSEC;
+    while (ktime_ns() < end) {
+    }
+    u32 elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    irq_restore(flags);
+
+    u32 per_tick = elapsed * (1000 / APIC_TIMER_CALIBRATE_MS) / TIMER_HZ;
+    if (per_tick == 0) return 0;
+
+    /* Both raise IRQ0's vector: shut the PIT's line */
+    apic_timer_source.count_per_tick = per_tick;
+    timer_set_source(&apic_timer_source);
+    irq_chip->mask(0);
+
+    klog_info("APIC: timer at %u counts per tick", per_tick);
+    return 1;
+}
@@ -0,0 +1,24 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "types.h"
+#include "isr.h"
+
+/* Local APIC and IOAPIC, found through the ACPI MADT. ISA IRQs keep
+ * their IRQ0..IRQ15 vectors (after source overrides), further IOAPIC
+ * inputs become IRQ16 and up */
+#define APIC_SPURIOUS_VECTOR 0xFF
+#define APIC_TIMER_CALIBRATE_MS 10
+
+extern irq_chip_t apic_chip;
+extern void apic_spurious_stub();
+
+/* Route interrupts through the APICs and mask the PIC; 0 (and nothing
+ * changed) when there is no usable MADT */
+int init_apic(void);
+
+/* Move the tick to the local APIC timer; needs the TSC clocksource to
+ * calibrate against. Returns 0 when the PIT has to stay */
+int init_apic_timer(void);
+
+#endif
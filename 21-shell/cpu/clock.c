@@ -0,0 +1,136 @@
+#include "clock.h"
+#include "timer.h"
+#include "ports.h"
+#include "isr.h"
+#include "../libc/function.h"
+#include "../kernel/klog.h"
+
+#define CPUID_TSC (1u << 4)
+
+/* PIT channel 2 is gated through port 0x61 and its output can be read
+ * back there, which makes it a stopwatch that needs no interrupt */
+#define PIT_FREQUENCY   1193180
+#define PIT_CHANNEL2    0x42
+#define PIT_COMMAND     0x43
+#define SYSTEM_CONTROL  0x61
+#define GATE2_ENABLE    0x01
+#define SPEAKER_ENABLE  0x02
+#define OUT2_STATUS     0x20
+#define CALIBRATE_SPIN_LIMIT 0x1000000
+
+/* ns = cycles * tsc_mult >> tsc_shift, counted from tsc_base */
+static u64 tsc_base = 0;
+static u32 tsc_mult = 0;
+static u32 tsc_shift = 0;
+static u32 tsc_khz = 0;
+
+static inline u64 rdtsc(void) {
+    u32 low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((u64)high << 32) | low;
+}
+
+u64 div_u64(u64 dividend, u32 divisor, u32 *remainder) {
+    u32 high = (u32)(dividend >> 32);
+    u32 rem = high % divisor;
+    u32 quotient_low;
+
+    /* rem < divisor, so (rem:low) / divisor fits divl's 32-bit result */
+    asm("divl %4" : "=a"(quotient_low), "=d"(rem)
+                  : "a"((u32)dividend), "d"(rem), "rm"(divisor));
+    if (remainder) *remainder = rem;
+    return ((u64)(high / divisor) << 32) | quotient_low;
+}
+
+/* TSC cycles during CLOCK_CALIBRATE_MS of PIT channel 2 counting down in
+ * mode 0; 0 if its output never went high */
+static u64 calibrate_round(void) {
+    u32 count = PIT_FREQUENCY / 1000 * CLOCK_CALIBRATE_MS;
+    u8 control = port_byte_in(SYSTEM_CONTROL);
+
+    port_byte_out(SYSTEM_CONTROL, (control & ~SPEAKER_ENABLE) | GATE2_ENABLE);
+    port_byte_out(PIT_COMMAND, 0xB0);  /* Channel 2, lobyte/hibyte, mode 0 */
+    port_byte_out(PIT_CHANNEL2, (u8)(count & 0xFF));
+    port_byte_out(PIT_CHANNEL2, (u8)((count >> 8) & 0xFF));
+
+    u64 start = rdtsc();
+    u32 spins = 0;
+    while (!(port_byte_in(SYSTEM_CONTROL) & OUT2_STATUS)) {
+        if (++spins == CALIBRATE_SPIN_LIMIT) {
+            port_byte_out(SYSTEM_CONTROL, control);
+            return 0;
+        }
+    }
+    u64 cycles = rdtsc() - start;
+
+    port_byte_out(SYSTEM_CONTROL, control);
+    return cycles;
+}
+
+void init_clock(void) {
+    u32 eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    UNUSED(ebx);
+    UNUSED(ecx);
+
+    if (!(edx & CPUID_TSC)) {
+        klog_warn("Clock: no TSC, using timer ticks");
+        return;
+    }
+
+    /* Interrupts off: anything that stretches a round only makes it
+     * longer, so the shortest one is the most accurate */
+    u32 flags = irq_save();
+    u64 best = 0;
+    for (int i = 0; i < CLOCK_CALIBRATE_ROUNDS; i++) {
+        u64 cycles = calibrate_round();
+        if (cycles && (!best || cycles < best)) best = cycles;
+    }
+    irq_restore(flags);
+
+    u64 khz = div_u64(best, CLOCK_CALIBRATE_MS, 0);
+    if (!khz || (khz >> 32)) {
+        klog_warn("Clock: TSC calibration failed, using timer ticks");
+        return;
+    }
+
+    /* Largest shift whose multiplier still fits 32 bits */
+    u32 shift = 32;
+    u64 mult = div_u64((u64)NSEC_PER_MSEC << shift, (u32)khz, 0);
+    while (mult >> 32) {
+        shift--;
+        mult = div_u64((u64)NSEC_PER_MSEC << shift, (u32)khz, 0);
+    }
+
+    tsc_khz = (u32)khz;
+    tsc_shift = shift;
+    tsc_base = rdtsc();
+    tsc_mult = (u32)mult;
+    klog_info("Clock: TSC at %u kHz", tsc_khz);
+}
+
+/* Nanoseconds since init_clock() */
+u64 ktime_ns(void) {
+    if (!tsc_mult) {
+        return (u64)tick * (NSEC_PER_SEC / TIMER_HZ);
+    }
+
+    /* Split the product so it cannot overflow 64 bits */
+    u64 cycles = rdtsc() - tsc_base;
+    u64 low = ((u64)(u32)cycles * tsc_mult) >> tsc_shift;
+    u64 high = ((u64)(u32)(cycles >> 32) * tsc_mult) << (32 - tsc_shift);
+    return high + low;
+}
+
+u32 clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+u64 clock_cycles(void) {
+    return tsc_mult ? rdtsc() : 0;
+}
+
+/* Fits 32 bits for anything shorter than about four seconds */
+u32 cycles_to_ns(u32 cycles) {
+    return (u32)(((u64)cycles * tsc_mult) >> tsc_shift);
+}
@@ -0,0 +1,27 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+/* Monotonic clock. The TSC is calibrated against PIT channel 2 at boot
+ * and converted to nanoseconds with a multiply and a shift; without a
+ * TSC the clock falls back to timer ticks (20 ms resolution). */
+#define NSEC_PER_SEC  1000000000u
+#define NSEC_PER_MSEC 1000000u
+
+#define CLOCK_CALIBRATE_MS     10  /* Length of one calibration run */
+#define CLOCK_CALIBRATE_ROUNDS 3   /* Shortest run wins */
+
+void init_clock(void);
+u64 ktime_ns(void);
+u32 clock_tsc_khz(void);  /* 0 when running on timer ticks */
+
+/* Short intervals: raw TSC reads, converted once the interval is known.
+ * Both return 0 without a calibrated TSC */
+u64 clock_cycles(void);
+u32 cycles_to_ns(u32 cycles);
+
+/* 64 by 32 bit division, there is no libgcc to do it for us */
+u64 div_u64(u64 dividend, u32 divisor, u32 *remainder);
+
+#endif
@@ -0,0 +1,133 @@
+#include "fpu.h"
+#include "isr.h"
+#include "../libc/mem.h"
+#include "../libc/function.h"
+#include "../drivers/screen.h"
+#include "../kernel/klog.h"
+
+#define CR0_MP 0x02   /* WAIT/FWAIT honour TS too */
+#define CR0_EM 0x04   /* No FPU: trap every FPU instruction */
+#define CR0_TS 0x08   /* Task switched: next FPU instruction raises #NM */
+#define CR0_NE 0x20   /* Report FPU errors as #MF, not through the PIC */
+#define CR4_OSFXSR     0x200
+#define CR4_OSXMMEXCPT 0x400
+
+#define CPUID_FPU  (1u << 0)
+#define CPUID_FXSR (1u << 24)
+#define CPUID_SSE  (1u << 25)
+
+static int fpu_present = 0;
+static int has_fxsr = 0;
+
+/* Process whose state is in the FPU registers right now */
+static process_t *fpu_owner = 0;
+
+/* What a process sees on its first FPU instruction. Restoring this
+ * instead of just FNINIT also clears the previous owner's XMM values */
+static u8 fpu_initial_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static u32 read_cr0(void) {
+    u32 cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static void write_cr0(u32 cr0) {
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static void fpu_save(u8 *area) {
+    if (has_fxsr) asm volatile("fxsave (%0)" : : "r"(area) : "memory");
+    else asm volatile("fnsave (%0)" : : "r"(area) : "memory");
+}
+
+static void fpu_restore(u8 *area) {
+    if (has_fxsr) asm volatile("fxrstor (%0)" : : "r"(area) : "memory");
+    else asm volatile("frstor (%0)" : : "r"(area) : "memory");
+}
+
+/* #NM: the running process touched the FPU while TS was set. Park the
+ * owner's registers and load the running process' */
+static void device_not_available_handler(registers_t *r) {
+    UNUSED(r);
+    asm volatile("clts");
+
+    process_t *proc = current_process;
+    if (!fpu_present || !proc || proc == fpu_owner) return;
+
+    if (!proc->fpu_state) {
+        /* Slab objects of this size class are 512 aligned, as FXSAVE needs */
+        proc->fpu_state = (u8*)kmalloc(FPU_STATE_SIZE, 0, 0);
+        if (!proc->fpu_state) {
+            /* Nowhere to keep the owner's state if we let this one in */
+            klog_error("FPU: no memory for the state of PID %d", proc->pid);
+            terminate_process(proc->pid);
+            schedule();
+            return;
+        }
+        memory_copy(fpu_initial_state, proc->fpu_state, FPU_STATE_SIZE);
+    }
+
+    if (fpu_owner) fpu_save(fpu_owner->fpu_state);
+    fpu_restore(proc->fpu_state);
+    fpu_owner = proc;
+}
+
+void init_fpu(void) {
+    u32 eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    UNUSED(ebx);
+    UNUSED(ecx);
+
+    if (!(edx & CPUID_FPU)) {
+        kprint("FPU: not present\n");
+        return;
+    }
+    fpu_present = 1;
+    has_fxsr = (edx & CPUID_FXSR) != 0;
+
+    u32 cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    if (has_fxsr) {
+        u32 cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (edx & CPUID_SSE) cr4 |= CR4_OSXMMEXCPT;
+        asm volatile("mov %0, %%cr4" : : "r"(cr4));
+    }
+
+    /* Clean state for every process' first use */
+    asm volatile("fninit");
+    if (edx & CPUID_SSE) {
+        u32 mxcsr = 0x1F80;  /* All SIMD exceptions masked */
+        asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+    fpu_save(fpu_initial_state);
+    if (!has_fxsr) asm volatile("fninit");  /* FNSAVE reinitialised it anyway */
+
+    register_interrupt_handler(7, device_not_available_handler);
+    write_cr0(cr0 | CR0_TS);
+
+    kprint(has_fxsr ? "FPU: lazy switching, FXSAVE\n" : "FPU: lazy switching, FSAVE\n");
+}
+
+/* Scheduler hook: only the owner may use the registers without a trap */
+void fpu_switch_to(process_t *proc) {
+    if (!fpu_present) return;
+
+    u32 cr0 = read_cr0();
+    u32 wanted = (proc == fpu_owner) ? (cr0 & ~CR0_TS) : (cr0 | CR0_TS);
+    if (wanted != cr0) write_cr0(wanted);
+}
+
+/* The process is going away: its registers no longer matter */
+void fpu_release(process_t *proc) {
+    if (proc == fpu_owner) fpu_owner = 0;
+    if (proc->fpu_state) {
+        kfree((u32)proc->fpu_state);
+        proc->fpu_state = 0;
+    }
+}
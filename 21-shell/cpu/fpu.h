@@ -0,0 +1,17 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "../kernel/process.h"
+
+/* Lazy FPU/SSE switching. The x87/SSE registers stay with whichever
+ * process used them last; switching to anybody else sets CR0.TS, so
+ * their first FPU instruction raises #NM and only then is the state
+ * swapped. A process gets its save area on first use. */
+#define FPU_STATE_SIZE 512  /* FXSAVE layout, FSAVE fits in it too */
+
+void init_fpu(void);
+void fpu_switch_to(process_t *proc);
+void fpu_release(process_t *proc);
+
+#endif
@@ -3,6 +3,7 @@
 #include "../cpu/types.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
+#include "isr.h"
 
 // GDT entry structure
 typedef struct {
@@ -21,10 +22,15 @@ typedef struct {
 } __attribute__((packed)) gdt_ptr_t;
 
 // GDT entries (extended for process segments)
-#define MAX_GDT_ENTRIES 32  // Support up to 16 processes (2 segments each) + kernel segments
+#define MAX_GDT_ENTRIES 32
+#define GDT_PROCESS_FIRST 5  // Kernel and shared user segments come first
+#define GDT_PROCESS_PAIRS ((MAX_GDT_ENTRIES - GDT_PROCESS_FIRST) / 2)
 gdt_entry_t gdt[MAX_GDT_ENTRIES];
 gdt_ptr_t gdt_ptr;
 
+// Bit per code/data descriptor pair handed to a process
+static u32 gdt_pairs_used = 0;
+
 // External function to load GDT
 extern void gdt_flush(u32);
 
@@ -64,13 +70,20 @@ void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran) {
 }
 
 // Setup process-specific GDT segments
-void setup_process_segments(process_t *proc) {
-    int segment_index = 5 + (proc->pid * 2);  // Start after kernel segments (0-4)
-    
-    if (segment_index >= MAX_GDT_ENTRIES - 1) {
-        kprint("Error: Too many processes for GDT\n");
-        return;
+// The pool is also released from the IRQ exit path (zombie reaping), so
+// claiming a pair and its protections happens with interrupts off
+int setup_process_segments(process_t *proc) {
+    u32 flags = irq_save();
+    u32 free_pairs = ~gdt_pairs_used & ((1u << GDT_PROCESS_PAIRS) - 1);
+    if (!free_pairs) {
+        irq_restore(flags);
+        proc->code_segment = 0;
+        proc->data_segment = 0;
+        return 0;
     }
+    int pair = __builtin_ctz(free_pairs);
+    gdt_pairs_used |= 1u << pair;
+    int segment_index = GDT_PROCESS_FIRST + pair * 2;
     
     // Code segment for process
     gdt_set_gate(segment_index, (u32)proc->heap, 0x1000, 0x9A, 0xCF);
@@ -91,6 +104,7 @@ void setup_process_segments(process_t *proc) {
     // Data segment protection
     allocate_segment_protection(proc->data_segment, (u32)proc->heap, 0x1000, 
                                privilege, SEGMENT_PERMISSION_READ | SEGMENT_PERMISSION_WRITE);
+    irq_restore(flags);
     
     kprint("Process segments created: Code=");
     char seg_str[10];
@@ -103,10 +117,32 @@ void setup_process_segments(process_t *proc) {
     int_to_ascii(privilege, seg_str);
     kprint(seg_str);
     kprint(")\n");
+    return 1;
+}
+
+// Give the process' descriptors and their protections back to the pool
+void release_process_segments(process_t *proc) {
+    if (!proc->code_segment) return;
+    
+    u32 flags = irq_save();
+    int segment_index = proc->code_segment / 8;
+    gdt_set_gate(segment_index, 0, 0, 0, 0);
+    gdt_set_gate(segment_index + 1, 0, 0, 0, 0);
+    gdt_pairs_used &= ~(1u << ((segment_index - GDT_PROCESS_FIRST) / 2));
+    
+    int protection = find_segment_protection(proc->code_segment);
+    if (protection >= 0) free_segment_protection(protection);
+    protection = find_segment_protection(proc->data_segment);
+    if (protection >= 0) free_segment_protection(protection);
+    
+    proc->code_segment = 0;
+    proc->data_segment = 0;
+    irq_restore(flags);
 }
 
 // Assign process segments (for existing processes)
 void assign_process_segments(process_t *proc) {
     // This function can be used to reassign segments if needed
+    release_process_segments(proc);
     setup_process_segments(proc);
 } 
\ No newline at end of file
@@ -14,8 +14,10 @@
 void gdt_init(void);
 void gdt_set_gate(int num, u32 base, u32 limit, u8 access, u8 gran);
 
-// Process segment management
-void setup_process_segments(process_t *proc);
+// Process segment management. Descriptor pairs come from a pool, not
+// from the PID; setup returns 0 when the pool is exhausted
+int setup_process_segments(process_t *proc);
+void release_process_segments(process_t *proc);
 void assign_process_segments(process_t *proc);
 
 // GDT flush function (assembly)
@@ -6,10 +6,14 @@ idt_gate_t idt[IDT_ENTRIES];
 idt_register_t idt_reg;
 
 void set_idt_gate(int n, u32 handler) {
+    set_idt_gate_flags(n, handler, IDT_INTERRUPT_GATE);
+}
+
+void set_idt_gate_flags(int n, u32 handler, u8 flags) {
     idt[n].low_offset = low_16(handler);
     idt[n].sel = KERNEL_CS;
     idt[n].always0 = 0;
-    idt[n].flags = 0x8E; 
+    idt[n].flags = flags;
     idt[n].high_offset = high_16(handler);
 }
 
@@ -6,6 +6,11 @@
 /* Segment selectors */
 #define KERNEL_CS 0x08
 
+/* Gate types: interrupt gates clear IF, trap gates leave it alone. Only
+ * DPL 3 gates can be reached with 'int' from user mode */
+#define IDT_INTERRUPT_GATE 0x8E
+#define IDT_USER_TRAP_GATE 0xEF
+
 /* How every interrupt gate (handler) is defined */
 typedef struct {
     u16 low_offset; /* Lower 16 bits of handler function address */
@@ -34,6 +39,7 @@ extern idt_register_t idt_reg;
 
 /* Functions implemented in idt.c */
 void set_idt_gate(int n, u32 handler);
+void set_idt_gate_flags(int n, u32 handler, u8 flags);
 void set_idt();
 
 #endif
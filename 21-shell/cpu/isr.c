@@ -9,15 +9,39 @@
 #include "../kernel/memory.h"
 #include "../kernel/process.h"
 #include "../kernel/mpu.h"
+#include "../kernel/syscalls.h"
+#include "paging.h"
+#include "pic.h"
+#include "apic.h"
+#include "clock.h"
 
-isr_t interrupt_handlers[256];
+/* Handler chains per vector, linked through a fixed pool: handlers are
+ * registered before the heap matters and never from an interrupt */
+typedef struct handler_node {
+    isr_t handler;
+    struct handler_node *next;
+} handler_node_t;
+
+static handler_node_t handler_pool[MAX_INTERRUPT_HANDLERS];
+static handler_node_t *free_handlers = 0;
+static handler_node_t *interrupt_handlers[256];
+
+static interrupt_stats_t interrupt_stats[256];
+
+/* The PIC until init_apic() finds something better */
+irq_chip_t *irq_chip = &pic_chip;
 
 // Function declarations
-void page_fault_handler(registers_t r);
+void page_fault_handler(registers_t *r);
 
 /* Can't do this with a loop because we need the address
  * of the function names */
 void isr_install() {
+    for (int i = 0; i < MAX_INTERRUPT_HANDLERS; i++) {
+        handler_pool[i].next = free_handlers;
+        free_handlers = &handler_pool[i];
+    }
+
     set_idt_gate(0, (u32)isr0);
     set_idt_gate(1, (u32)isr1);
     set_idt_gate(2, (u32)isr2);
@@ -55,16 +79,7 @@ void isr_install() {
     set_idt_gate(31, (u32)isr31);
 
     // Remap the PIC
-    port_byte_out(0x20, 0x11);
-    port_byte_out(0xA0, 0x11);
-    port_byte_out(0x21, 0x20);
-    port_byte_out(0xA1, 0x28);
-    port_byte_out(0x21, 0x04);
-    port_byte_out(0xA1, 0x02);
-    port_byte_out(0x21, 0x01);
-    port_byte_out(0xA1, 0x01);
-    port_byte_out(0x21, 0x0);
-    port_byte_out(0xA1, 0x0); 
+    pic_remap();
 
     // Install the IRQs
     set_idt_gate(32, (u32)irq0);
@@ -83,6 +98,17 @@ void isr_install() {
     set_idt_gate(45, (u32)irq13);
     set_idt_gate(46, (u32)irq14);
     set_idt_gate(47, (u32)irq15);
+    set_idt_gate(48, (u32)irq16);
+    set_idt_gate(49, (u32)irq17);
+    set_idt_gate(50, (u32)irq18);
+    set_idt_gate(51, (u32)irq19);
+    set_idt_gate(52, (u32)irq20);
+    set_idt_gate(53, (u32)irq21);
+    set_idt_gate(54, (u32)irq22);
+    set_idt_gate(55, (u32)irq23);
+
+    set_idt_gate(SCHED_YIELD_VECTOR, (u32)sched_yield_stub);
+    set_idt_gate_flags(SYSCALL_INTERRUPT, (u32)syscall_stub, IDT_USER_TRAP_GATE);
 
     set_idt(); // Load with ASM
 }
@@ -126,99 +152,228 @@ char *exception_messages[] = {
     "Reserved"
 };
 
-void isr_handler(registers_t r) {
+/* Under 1 us, under 4 us, ... under 4096 us, slower */
+static int latency_bucket(u32 ns) {
+    u32 us = ns / 1000;
+    if (us == 0) return 0;
+    int bucket = (31 - __builtin_clz(us)) / 2 + 1;
+    return bucket < IRQ_LATENCY_BUCKETS ? bucket : IRQ_LATENCY_BUCKETS - 1;
+}
+
+/* Run every handler chained on the frame's vector. Returns 0 if there
+ * was none */
+static int dispatch(registers_t *r) {
+    interrupt_stats_t *stats = &interrupt_stats[(u8)r->int_no];
+    stats->count++;
+
+    handler_node_t *node = interrupt_handlers[(u8)r->int_no];
+    if (!node) {
+        stats->unhandled++;
+        return 0;
+    }
+
+    u64 start = clock_cycles();
+    for (; node; node = node->next) {
+        node->handler(r);
+    }
+    u32 ns = cycles_to_ns((u32)(clock_cycles() - start));
+
+    if (ns < stats->min_ns || stats->count - stats->unhandled == 1) stats->min_ns = ns;
+    if (ns > stats->max_ns) stats->max_ns = ns;
+    stats->total_ns += ns;
+    stats->buckets[latency_bucket(ns)]++;
+    return 1;
+}
+
+void isr_handler(registers_t *r) {
+    /* Exceptions with a registered handler (e.g. page faults) */
+    if (dispatch(r)) return;
+
     kprint("received interrupt: ");
     char s[3];
-    int_to_ascii(r.int_no, s);
+    int_to_ascii(r->int_no, s);
     kprint(s);
     kprint("\n");
-    kprint(exception_messages[r.int_no]);
+    kprint(exception_messages[r->int_no]);
     kprint("\n");
 }
 
 // Page fault handler (interrupt 14)
-void page_fault_handler(registers_t r) {
-    (void)r; // Suppress unused parameter warning
+void page_fault_handler(registers_t *r) {
     u32 fault_address;
     asm volatile("mov %%cr2, %0" : "=r" (fault_address));
     
+    // First touch of a page in one of the process' regions: map it in
+    int current_pid = get_current_pid();
+    if (current_pid >= 0 && !(r->err_code & PF_PRESENT) &&
+        resolve_page_fault(fault_address, current_pid, r->err_code & PF_WRITE)) {
+        return;
+    }
+    
     kprint("Page Fault! ( ");
-    char addr_str[10];
+    char addr_str[12];
     int_to_ascii(fault_address, addr_str);
     kprint(addr_str);
     kprint(" )\n");
     
-    // Check if this is a memory access violation
-    int current_pid = get_current_pid();
-    if (current_pid >= 0) {
-        // First check MPU regions (hardware-like protection)
-        int mpu_region_id = find_mpu_region(fault_address);
-        if (mpu_region_id != -1) {
-            // Address is in MPU region, check permissions
-            mpu_region_t *mpu_region = &mpu_regions[mpu_region_id];
-            if (mpu_region->process_id != current_pid) {
-                kprint("MPU violation - wrong process\n");
-                mpu_violation_handler(fault_address, current_pid, MPU_PERMISSION_READ);
-                terminate_process(current_pid);
-            } else {
-                kprint("MPU violation - insufficient permissions\n");
-                mpu_violation_handler(fault_address, current_pid, MPU_PERMISSION_READ);
-                terminate_process(current_pid);
-            }
+    // Anything else is a memory access violation
+    if (current_pid > 0) {
+        u8 access = (r->err_code & PF_WRITE) ? MPU_PERMISSION_WRITE : MPU_PERMISSION_READ;
+        if (find_mpu_region(fault_address) != -1) {
+            mpu_violation_handler(fault_address, current_pid, access);
+        } else if (find_memory_region(fault_address, current_pid) == -1) {
+            kprint("Memory access violation - address not in any region\n");
+        } else if (r->err_code & PF_PRESENT) {
+            kprint("Memory access violation - insufficient permissions\n");
         } else {
-            // Check traditional memory regions
-            int region_id = find_memory_region(fault_address);
-            if (region_id == -1) {
-                kprint("Memory access violation - address not in any region\n");
-                terminate_process(current_pid);
-            } else {
-                // Check if process has permission to access this region
-                memory_region_t *region = &memory_regions[region_id];
-                if (region->process_id != current_pid) {
-                    kprint("Memory access violation - wrong process\n");
-                    terminate_process(current_pid);
-                } else {
-                    kprint("Memory access violation - insufficient permissions\n");
-                    terminate_process(current_pid);
-                }
-            }
+            kprint("Memory access violation - out of memory\n");
         }
-    } else {
-        kprint("Page fault in kernel mode\n");
+        terminate_process(current_pid);
+        // Already on the zombie list: never comes back from here
+        schedule();
+        return;
     }
     
+    kprint("Page fault in kernel mode\n");
     kprint("System halted due to page fault\n");
     asm volatile("cli");
     asm volatile("hlt");
 }
 
-void register_interrupt_handler(u8 n, isr_t handler) {
-    interrupt_handlers[n] = handler;
+/* Append 'handler' to the chain of vector 'n'. The first handler for an
+ * IRQ line also opens the line at the controller. Returns 0 when the
+ * handler pool is exhausted */
+int register_interrupt_handler(u8 n, isr_t handler) {
+    u32 flags = irq_save();
+    handler_node_t **link = &interrupt_handlers[n];
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->handler == handler) {
+            irq_restore(flags);
+            return 1;
+        }
+    }
+
+    handler_node_t *node = free_handlers;
+    if (!node) {
+        irq_restore(flags);
+        kprint("Interrupts: no room for another handler\n");
+        return 0;
+    }
+    free_handlers = node->next;
+    node->handler = handler;
+    node->next = 0;
+    *link = node;
+
+    if (node == interrupt_handlers[n] && n >= IRQ0 && n < IRQ0 + IRQ_LINES) {
+        irq_chip->unmask(n - IRQ0);
+    }
+    irq_restore(flags);
+    return 1;
+}
+
+/* Take 'handler' off the chain of vector 'n'; the line is masked again
+ * once nobody is left to handle it */
+void unregister_interrupt_handler(u8 n, isr_t handler) {
+    u32 flags = irq_save();
+    for (handler_node_t **link = &interrupt_handlers[n]; *link; link = &(*link)->next) {
+        handler_node_t *node = *link;
+        if (node->handler != handler) continue;
+
+        *link = node->next;
+        node->next = free_handlers;
+        free_handlers = node;
+        if (!interrupt_handlers[n] && n >= IRQ0 && n < IRQ0 + IRQ_LINES) {
+            irq_chip->mask(n - IRQ0);
+        }
+        break;
+    }
+    irq_restore(flags);
 }
 
-void irq_handler(registers_t r) {
-    /* After every interrupt we need to send an EOI to the PICs
-     * or they will not send another interrupt again */
-    if (r.int_no >= 40) port_byte_out(0xA0, 0x20); /* slave */
-    port_byte_out(0x20, 0x20); /* master */
+u32 interrupt_count(u8 n) {
+    return interrupt_stats[n].count;
+}
 
-    /* Handle the interrupt in a more modular way */
-    if (interrupt_handlers[r.int_no] != 0) {
-        isr_t handler = interrupt_handlers[r.int_no];
-        handler(r);
+u32 interrupt_unhandled_count(u8 n) {
+    return interrupt_stats[n].unhandled;
+}
+
+/* A consistent copy: handlers on other vectors may update theirs meanwhile */
+int get_interrupt_stats(u8 n, interrupt_stats_t *stats) {
+    if (!stats) return 0;
+    u32 flags = irq_save();
+    *stats = interrupt_stats[n];
+    irq_restore(flags);
+    return stats->count != 0;
+}
+
+static void print_column(u32 value, int width) {
+    char num_str[12];
+    int_to_ascii(value, num_str);
+    for (int pad = width - strlen(num_str); pad > 0; pad--) {
+        kprint(" ");
+    }
+    kprint(num_str);
+}
+
+/* One row per vector that fired: call counts, handler time and its
+ * distribution in percent of the handled calls */
+void print_interrupt_stats(void) {
+    kprint("=== Interrupts (handler time in ns, histogram in % per us bucket) ===\n");
+    kprint("VEC    COUNT MISS MIN_NS AVG_NS  MAX_NS   <1   <4  <16  <64 <256<1024<4096 more\n");
+
+    interrupt_stats_t stats;
+    for (u32 n = 0; n < 256; n++) {
+        if (!get_interrupt_stats((u8)n, &stats)) continue;
+        u32 handled = stats.count - stats.unhandled;
+
+        print_column(n, 3);
+        print_column(stats.count, 9);
+        print_column(stats.unhandled, 5);
+        print_column(stats.min_ns, 7);
+        print_column(handled ? (u32)div_u64(stats.total_ns, handled, 0) : 0, 7);
+        print_column(stats.max_ns, 8);
+        for (int b = 0; b < IRQ_LATENCY_BUCKETS; b++) {
+            u32 percent = handled ? (u32)div_u64((u64)stats.buckets[b] * 100, handled, 0) : 0;
+            print_column(percent, 5);
+        }
+        kprint("\n");
     }
+    if (!clock_tsc_khz()) kprint("No TSC: handler times are not measured\n");
+}
+
+u32 irq_save(void) {
+    u32 eflags;
+    asm volatile("pushf; pop %0; cli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+void irq_restore(u32 eflags) {
+    if (eflags & 0x200) asm volatile("sti" : : : "memory");
+}
+
+void irq_handler(registers_t *r) {
+    /* Acknowledge first: the handler may not return here before the
+     * next interrupt on this line is due */
+    irq_chip->eoi(r->int_no - IRQ0);
+
+    /* Handle the interrupt in a more modular way */
+    dispatch(r);
 }
 
 void irq_install() {
-    /* Enable IRQ 1 (keyboard) in PIC */
-    u8 mask = port_byte_in(0x21); /* Read current mask */
-    mask &= ~0x02; /* Clear bit 1 to enable IRQ 1 (keyboard) */
-    port_byte_out(0x21, mask); /* Write back mask */
+    /* IOAPIC and local APIC when the MADT lists them, else the PIC */
+    init_apic();
+    kprint("Interrupt controller: ");
+    kprint((char*)irq_chip->name);
+    kprint("\n");
     
     /* Enable interruptions */
     asm volatile("sti");
     /* IRQ0: timer - enabled */
-    init_timer(50);
+    init_timer(TIMER_HZ);
+    /* The local APIC timer takes the tick over when it can */
+    init_apic_timer();
     /* IRQ1: keyboard */
     init_keyboard();
 }
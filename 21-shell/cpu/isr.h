@@ -53,6 +53,14 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void irq17();
+extern void irq18();
+extern void irq19();
+extern void irq20();
+extern void irq21();
+extern void irq22();
+extern void irq23();
 
 #define IRQ0 32
 #define IRQ1 33
@@ -70,6 +78,34 @@ extern void irq15();
 #define IRQ13 45
 #define IRQ14 46
 #define IRQ15 47
+#define IRQ16 48
+#define IRQ17 49
+#define IRQ18 50
+#define IRQ19 51
+#define IRQ20 52
+#define IRQ21 53
+#define IRQ22 54
+#define IRQ23 55
+
+/* Interrupt lines with a vector: the 16 ISA IRQs, plus the PCI ones an
+ * IOAPIC adds */
+#define IRQ_LINES 24
+
+/* Interrupt controller behind the IRQ lines: the 8259 PICs, or the
+ * IOAPIC with the local APIC when ACPI describes them */
+typedef struct {
+    const char *name;
+    void (*eoi)(u32 irq);
+    void (*mask)(u32 irq);
+    void (*unmask)(u32 irq);
+} irq_chip_t;
+
+extern irq_chip_t *irq_chip;
+
+/* Software interrupt used by schedule() to give up the CPU. It builds
+ * the same frame as an IRQ, so yielding and preemption share one path */
+#define SCHED_YIELD_VECTOR 0x81
+extern void sched_yield_stub();
 
 /* Struct which aggregates many registers */
 typedef struct {
@@ -80,10 +116,42 @@ typedef struct {
 } registers_t;
 
 void isr_install();
-void isr_handler(registers_t r);
+void isr_handler(registers_t *r);
+void irq_handler(registers_t *r);
 void irq_install();
 
-typedef void (*isr_t)(registers_t);
-void register_interrupt_handler(u8 n, isr_t handler);
+/* Handlers get the frame the stub saved on the stack, so changes to it
+ * are what the interrupted code resumes with. Several handlers can
+ * share a vector; they run in the order they were registered */
+typedef void (*isr_t)(registers_t *);
+#define MAX_INTERRUPT_HANDLERS 32
+
+int register_interrupt_handler(u8 n, isr_t handler);
+void unregister_interrupt_handler(u8 n, isr_t handler);
+
+/* Interrupts taken on vector 'n' since boot, and how many of them found
+ * no handler */
+u32 interrupt_count(u8 n);
+u32 interrupt_unhandled_count(u8 n);
+
+/* Time spent in a vector's handler chain, from the TSC. Bucket b counts
+ * calls under 4^b microseconds, the last one everything slower */
+#define IRQ_LATENCY_BUCKETS 8
+
+typedef struct {
+    u32 count;
+    u32 unhandled;
+    u32 min_ns;
+    u32 max_ns;
+    u64 total_ns;
+    u32 buckets[IRQ_LATENCY_BUCKETS];
+} interrupt_stats_t;
+
+int get_interrupt_stats(u8 n, interrupt_stats_t *stats);  /* 0 if 'n' never fired */
+void print_interrupt_stats(void);
+
+/* Disable interrupts, returning the old EFLAGS for irq_restore() */
+u32 irq_save(void);
+void irq_restore(u32 eflags);
 
 #endif
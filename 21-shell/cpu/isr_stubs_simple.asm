@@ -1,5 +1,7 @@
 [extern isr_handler]
 [extern irq_handler]
+[extern schedule_from_irq]
+[extern syscall_handler]
 
 ; Common ISR code
 isr_common_stub:
@@ -13,8 +15,10 @@ isr_common_stub:
     mov fs, ax
     mov gs, ax
     
-    ; 2. Call C handler
+    ; 2. Call C handler with a pointer to the frame
+    push esp
     call isr_handler
+    add esp, 4
     
     ; 3. Restore state
     pop eax 
@@ -37,7 +41,17 @@ irq_common_stub:
     mov es, ax
     mov fs, ax
     mov gs, ax
+    push esp         ; The frame, by pointer
     call irq_handler ; Call C IRQ handler
+    add esp, 4
+irq_exit:
+    ; The saved registers form a registers_t frame at esp. The scheduler
+    ; returns the frame to resume: this one, or the one another process
+    ; left on its own stack when it was switched out
+    push esp
+    call schedule_from_irq
+    mov esp, eax
+irq_resume:
     pop ebx  
     mov ds, bx
     mov es, bx
@@ -48,6 +62,48 @@ irq_common_stub:
     sti
     iret 
 
+; schedule() gives up the CPU with 'int 0x81': same frame as an IRQ,
+; but there is no handler to run and no controller to acknowledge
+global sched_yield_stub
+sched_yield_stub:
+    push byte 0
+    push dword 0x81
+    pusha
+    mov ax, ds
+    push eax
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    jmp irq_exit
+
+; System call through 'int 0x80' (a DPL 3 trap gate, so interrupts stay
+; as the caller had them). The handler gets the frame by pointer and
+; leaves its result in the saved eax
+global syscall_stub
+syscall_stub:
+    push byte 0
+    push dword 0x80
+    pusha
+    mov ax, ds
+    push eax
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    push esp
+    call syscall_handler
+    add esp, 4
+    cli
+    jmp irq_exit
+
+; Spurious local APIC interrupts need no EOI and no handler
+global apic_spurious_stub
+apic_spurious_stub:
+    iret
+
 ; Generate ISR stubs programmatically
 %macro isr_stub 1
 isr%1:
@@ -79,7 +135,7 @@ irq%1:
 
 ; Generate all IRQ stubs
 %assign i 0
-%rep 16
+%rep 24
     irq_stub i, i+32
     %assign i i+1
 %endrep
@@ -93,7 +149,7 @@ irq%1:
 
 ; Export all IRQ symbols
 %assign i 0
-%rep 16
+%rep 24
     global irq%+i
     %assign i i+1
 %endrep 
\ No newline at end of file
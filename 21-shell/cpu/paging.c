@@ -0,0 +1,167 @@
+#include "paging.h"
+#include "../kernel/pmm.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+
+u32 *kernel_directory = 0;
+u32 *current_directory = 0;
+
+/* Set once the first process directory copied the kernel PDEs */
+static int directories_shared = 0;
+
+#define PDE_INDEX(addr) ((addr) >> 22)
+#define PTE_INDEX(addr) (((addr) >> 12) & 0x3FF)
+#define USER_PDE_FIRST  PDE_INDEX(USER_SPACE_START)
+#define USER_PDE_LAST   PDE_INDEX(USER_SPACE_END - 1)
+
+/* Frames come from the identity mapped part of RAM, so their physical
+ * address is also where the kernel can reach them */
+static u32 *alloc_table(void) {
+    u32 *table = (u32*)pmm_alloc_frame();
+    if (table) memset(table, 0, PAGE_SIZE);
+    return table;
+}
+
+static void invalidate_page(u32 virt) {
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+/* Build the kernel address space and turn paging on */
+void init_paging(void) {
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+
+    /* The kernel only reaches RAM through the identity map, so frames
+     * above it must never be handed out */
+    u32 top = stats.highest_address;
+    if (top > KERNEL_SPACE_END) {
+        pmm_reserve_range(KERNEL_SPACE_END, top);
+        top = KERNEL_SPACE_END;
+    }
+    if (top < 0x400000) top = 0x400000;
+
+    kernel_directory = alloc_table();
+    if (!kernel_directory) {
+        kprint("Paging: out of memory for the kernel directory\n");
+        return;
+    }
+
+    /* Every kernel page table is allocated now so user directories can
+     * simply share them. Page 0 stays unmapped to catch NULL pointers */
+    for (u32 addr = PAGE_SIZE; addr < top; addr += PAGE_SIZE) {
+        paging_map_page(kernel_directory, addr, addr, PAGE_WRITE);
+    }
+
+    paging_switch_directory(kernel_directory);
+
+    u32 cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= 0x80010000;  /* PG | WP: read-only pages bind ring 0 too */
+    asm volatile("mov %0, %%cr0" : : "r"(cr0));
+
+    kprint("Paging enabled: ");
+    char num_str[12];
+    int_to_ascii(top / (1024 * 1024), num_str);
+    kprint(num_str);
+    kprint(" MB identity mapped\n");
+}
+
+/* New address space: shares every kernel page table, empty user window */
+u32 *paging_create_directory(void) {
+    u32 *dir = alloc_table();
+    if (!dir) return 0;
+
+    directories_shared = 1;
+    for (u32 i = 0; i < 1024; i++) {
+        if (i < USER_PDE_FIRST || i > USER_PDE_LAST) {
+            dir[i] = kernel_directory[i];
+        }
+    }
+    return dir;
+}
+
+/* Free the user window (tables and the frames they map) and the directory */
+void paging_destroy_directory(u32 *dir) {
+    if (!dir || dir == kernel_directory) return;
+    if (dir == current_directory) paging_switch_directory(kernel_directory);
+
+    for (u32 i = USER_PDE_FIRST; i <= USER_PDE_LAST; i++) {
+        if (!(dir[i] & PAGE_PRESENT)) continue;
+
+        u32 *table = (u32*)(dir[i] & PAGE_FRAME_MASK);
+        for (u32 j = 0; j < 1024; j++) {
+            if (table[j] & PAGE_PRESENT) {
+                pmm_free_frame(table[j] & PAGE_FRAME_MASK);
+            }
+        }
+        pmm_free_frame((u32)table);
+    }
+    pmm_free_frame((u32)dir);
+}
+
+/* Identity map device registers, uncached. Only the kernel MMIO window
+ * (above the user window) and the identity mapped RAM qualify. A new
+ * page table there would not reach directories that already copied the
+ * kernel PDEs, so devices have to be mapped before the first process */
+int paging_map_mmio(u32 phys, u32 size) {
+    u32 first = phys & PAGE_FRAME_MASK;
+    u32 last = (phys + size - 1) & PAGE_FRAME_MASK;
+    if (last < first || (last >= USER_SPACE_START && first < USER_SPACE_END)) return 0;
+
+    for (u32 addr = first; ; addr += PAGE_SIZE) {
+        if (!(kernel_directory[PDE_INDEX(addr)] & PAGE_PRESENT) && directories_shared) {
+            kprint("Paging: MMIO mapped after the first process directory\n");
+            return 0;
+        }
+        if (!paging_map_page(kernel_directory, addr, addr,
+                             PAGE_WRITE | PAGE_NO_CACHE | PAGE_WRITE_THROUGH)) {
+            return 0;
+        }
+        if (addr == last) break;
+    }
+    return 1;
+}
+
+void paging_switch_directory(u32 *dir) {
+    if (!dir || dir == current_directory) return;
+    current_directory = dir;
+    asm volatile("mov %0, %%cr3" : : "r"(dir) : "memory");
+}
+
+/* Map one page. Returns 0 if a page table could not be allocated */
+int paging_map_page(u32 *dir, u32 virt, u32 phys, u32 flags) {
+    u32 pde = dir[PDE_INDEX(virt)];
+    u32 *table;
+
+    if (pde & PAGE_PRESENT) {
+        table = (u32*)(pde & PAGE_FRAME_MASK);
+    } else {
+        table = alloc_table();
+        if (!table) return 0;
+        /* Leave fine grained protection to the PTEs */
+        dir[PDE_INDEX(virt)] = (u32)table | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+    }
+
+    table[PTE_INDEX(virt)] = (phys & PAGE_FRAME_MASK) | (flags & 0xFFF) | PAGE_PRESENT;
+    if (dir == current_directory) invalidate_page(virt);
+    return 1;
+}
+
+/* Remove a mapping, returns the frame it pointed to (0 if none) */
+u32 paging_unmap_page(u32 *dir, u32 virt) {
+    u32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT)) return 0;
+
+    u32 *table = (u32*)(pde & PAGE_FRAME_MASK);
+    u32 pte = table[PTE_INDEX(virt)];
+    table[PTE_INDEX(virt)] = 0;
+    if (dir == current_directory) invalidate_page(virt);
+    return (pte & PAGE_PRESENT) ? (pte & PAGE_FRAME_MASK) : 0;
+}
+
+/* Raw page table entry for 'virt' (0 when the page table is missing) */
+u32 paging_get_entry(u32 *dir, u32 virt) {
+    u32 pde = dir[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT)) return 0;
+    return ((u32*)(pde & PAGE_FRAME_MASK))[PTE_INDEX(virt)];
+}
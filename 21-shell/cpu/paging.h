@@ -0,0 +1,47 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "types.h"
+
+/* Page table entry flags */
+#define PAGE_PRESENT  0x001
+#define PAGE_WRITE    0x002
+#define PAGE_USER     0x004
+#define PAGE_WRITE_THROUGH 0x008
+#define PAGE_NO_CACHE 0x010
+#define PAGE_ACCESSED 0x020
+#define PAGE_DIRTY    0x040
+
+#define PAGE_SIZE       0x1000
+#define PAGE_FRAME_MASK 0xFFFFF000
+
+/* Page fault error code bits */
+#define PF_PRESENT 0x1  /* 0: page not present, 1: protection violation */
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+
+/* Address space layout. The kernel identity maps physical memory below
+ * KERNEL_SPACE_END (supervisor only) and the top gigabyte is kept for
+ * kernel MMIO. Those page tables are shared by every address space; the
+ * user window in between is private to each process. */
+#define KERNEL_SPACE_END   0x40000000
+#define USER_SPACE_START   0x40000000
+#define USER_SPACE_END     0xC0000000
+#define USER_HEAP_BASE     0x40000000
+#define USER_STACK_TOP     0xBFFFF000
+#define USER_IPC_BASE      0x80000000  /* Zero-copy IPC buffers land here */
+#define USER_IPC_END       0xB0000000
+
+extern u32 *kernel_directory;
+extern u32 *current_directory;
+
+void init_paging(void);
+u32 *paging_create_directory(void);
+void paging_destroy_directory(u32 *dir);
+void paging_switch_directory(u32 *dir);
+int paging_map_page(u32 *dir, u32 virt, u32 phys, u32 flags);
+int paging_map_mmio(u32 phys, u32 size);
+u32 paging_unmap_page(u32 *dir, u32 virt);
+u32 paging_get_entry(u32 *dir, u32 virt);
+
+#endif
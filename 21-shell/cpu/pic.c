@@ -0,0 +1,54 @@
+#include "pic.h"
+#include "ports.h"
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+/* Master on IRQ0 (vector 32), slave on IRQ8, every line open */
+void pic_remap(void) {
+    port_byte_out(PIC1_COMMAND, 0x11);
+    port_byte_out(PIC2_COMMAND, 0x11);
+    port_byte_out(PIC1_DATA, IRQ0);
+    port_byte_out(PIC2_DATA, IRQ8);
+    port_byte_out(PIC1_DATA, 0x04);
+    port_byte_out(PIC2_DATA, 0x02);
+    port_byte_out(PIC1_DATA, 0x01);
+    port_byte_out(PIC2_DATA, 0x01);
+    port_byte_out(PIC1_DATA, 0x0);
+    port_byte_out(PIC2_DATA, 0x0);
+}
+
+/* Mask everything: the APICs take over. Still remapped, so a stray
+ * PIC interrupt lands on an IRQ vector, not on an exception */
+void pic_disable(void) {
+    port_byte_out(PIC1_DATA, 0xFF);
+    port_byte_out(PIC2_DATA, 0xFF);
+}
+
+/* After every interrupt we need to send an EOI to the PICs
+ * or they will not send another interrupt again */
+static void pic_eoi(u32 irq) {
+    if (irq >= 8) port_byte_out(PIC2_COMMAND, PIC_EOI); /* slave */
+    port_byte_out(PIC1_COMMAND, PIC_EOI); /* master */
+}
+
+static void pic_set_mask(u32 irq, int masked) {
+    if (irq >= 16) return;
+    u16 port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    u8 bit = 1 << (irq & 7);
+    u8 mask = port_byte_in(port);
+    port_byte_out(port, masked ? (mask | bit) : (mask & ~bit));
+}
+
+static void pic_mask(u32 irq) {
+    pic_set_mask(irq, 1);
+}
+
+static void pic_unmask(u32 irq) {
+    pic_set_mask(irq, 0);
+}
+
+irq_chip_t pic_chip = { "8259 PIC", pic_eoi, pic_mask, pic_unmask };
@@ -0,0 +1,13 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include "types.h"
+#include "isr.h"
+
+/* Legacy 8259 pair, remapped to IRQ0..IRQ15 */
+extern irq_chip_t pic_chip;
+
+void pic_remap(void);
+void pic_disable(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include "segment_protection.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
+#include "../kernel/klog.h"
 
 // Global segment protection management
 segment_protection_t segment_protections[MAX_SEGMENT_PROTECTIONS];
@@ -17,20 +18,27 @@ void init_segment_protection(void) {
 
 // Allocate a segment protection
 int allocate_segment_protection(u16 selector, u32 base, u32 limit, u8 privilege, u8 permissions) {
-    if (segment_protection_count >= MAX_SEGMENT_PROTECTIONS) {
-        kprint("Error: Maximum segment protections reached\n");
-        return -1;
-    }
-    
-    // Check for overlapping selectors
+    // Check for overlapping selectors, remembering the first freed entry
+    int free_id = -1;
     for (int i = 0; i < segment_protection_count; i++) {
         if (segment_protections[i].selector == selector) {
             kprint("Error: Segment selector already exists\n");
             return -1;
         }
+        if (segment_protections[i].selector == 0 && free_id == -1) {
+            free_id = i;
+        }
+    }
+    
+    if (free_id == -1) {
+        if (segment_protection_count >= MAX_SEGMENT_PROTECTIONS) {
+            kprint("Error: Maximum segment protections reached\n");
+            return -1;
+        }
+        free_id = segment_protection_count++;
     }
     
-    segment_protection_t *protection = &segment_protections[segment_protection_count++];
+    segment_protection_t *protection = &segment_protections[free_id];
     protection->selector = selector;
     protection->base = base;
     protection->limit = limit;
@@ -46,7 +54,7 @@ int allocate_segment_protection(u16 selector, u32 base, u32 limit, u8 privilege,
     kprint(sel_str);
     kprint(")\n");
     
-    return segment_protection_count - 1;
+    return free_id;
 }
 
 // Check segment access permissions
@@ -81,11 +89,8 @@ int find_segment_protection(u16 selector) {
 void free_segment_protection(u8 protection_id) {
     if (protection_id < segment_protection_count) {
         segment_protections[protection_id].selector = 0;
-        kprint("Segment protection freed: ");
-        char id_str[5];
-        int_to_ascii(protection_id, id_str);
-        kprint(id_str);
-        kprint("\n");
+        // Reached from zombie reaping on the IRQ exit path: no screen output
+        klog_debug("Segment protection freed: %u", protection_id);
     }
 }
 
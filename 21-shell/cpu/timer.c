@@ -4,25 +4,215 @@
 #include "../libc/function.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
+#include "../kernel/process.h"
 
 u32 tick = 0;
 
-static void timer_callback(registers_t regs) {
-    tick++;
+/* PIT input clock */
+#define PIT_FREQUENCY 1193180
+
+/* Ticks covered by the armed one-shot, 0 while the source is periodic */
+static u32 oneshot_ticks = 0;
+static u32 oneshot_count = 0;
+static u32 ticks_skipped = 0;
+
+/* Longest idle sleep, even with nothing pending */
+#define TIMER_MAX_IDLE_TICKS (TIMER_HZ * 10)
+
+/* Also touched from the tick handler: changes go under irq_save() */
+static ktimer_t *timer_wheel[TIMER_WHEEL_SIZE];
+
+static void timer_unlink(ktimer_t *timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else timer_wheel[timer->expires % TIMER_WHEEL_SIZE] = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = 0;
+    timer->prev = 0;
+    timer->pending = 0;
+}
+
+/* Arm 'timer' to fire 'ticks' ticks from now (at least one). Re-arming a
+ * pending timer moves it */
+void timer_add(ktimer_t *timer, u32 ticks, void (*callback)(void *data), void *data) {
+    u32 flags = irq_save();
+    if (timer->pending) timer_unlink(timer);
+
+    if (ticks == 0) ticks = 1;
+    timer->expires = tick + ticks;
+    timer->callback = callback;
+    timer->data = data;
+
+    ktimer_t **bucket = &timer_wheel[timer->expires % TIMER_WHEEL_SIZE];
+    timer->prev = 0;
+    timer->next = *bucket;
+    if (*bucket) (*bucket)->prev = timer;
+    *bucket = timer;
+    timer->pending = 1;
+    irq_restore(flags);
+}
+
+void timer_cancel(ktimer_t *timer) {
+    u32 flags = irq_save();
+    if (timer->pending) timer_unlink(timer);
+    irq_restore(flags);
+}
+
+u32 timer_ms_to_ticks(u32 ms) {
+    /* Split so ms * TIMER_HZ cannot overflow (no 64-bit division here) */
+    u32 ticks = ms / 1000 * TIMER_HZ + ((ms % 1000) * TIMER_HZ + 999) / 1000;
+    return ticks ? ticks : 1;
+}
+
+/* Fire whatever is due in this tick's bucket. A callback may add or
+ * cancel timers, so rescan the bucket after each one */
+static void run_timers(void) {
+    ktimer_t **bucket = &timer_wheel[tick % TIMER_WHEEL_SIZE];
+    ktimer_t *timer = *bucket;
+    while (timer) {
+        if ((int)(tick - timer->expires) >= 0) {
+            timer_unlink(timer);
+            timer->callback(timer->data);
+            timer = *bucket;
+        } else {
+            timer = timer->next;
+        }
+    }
+}
+
+/* Move time on by 'ticks', firing every bucket on the way */
+static void advance_ticks(u32 ticks) {
+    for (u32 i = 0; i < ticks; i++) {
+        tick++;
+        run_timers();
+    }
+    scheduler_tick(ticks);
+}
+
+/* Channel 0, lobyte/hibyte. Mode 3 (square wave) repeats, mode 0
+ * interrupts once when the count runs out */
+static void pit_program(u8 command, u32 count) {
+    port_byte_out(0x43, command); /* Command port */
+    port_byte_out(0x40, (u8)(count & 0xFF));
+    port_byte_out(0x40, (u8)((count >> 8) & 0xFF));
+}
+
+static void pit_periodic(u32 count) {
+    pit_program(0x36, count);
+}
+
+static void pit_oneshot(u32 count) {
+    pit_program(0x30, count);
+}
+
+static u32 pit_read_count(void) {
+    port_byte_out(0x43, 0x00); /* Latch channel 0 */
+    u32 low = port_byte_in(0x40);
+    u32 high = port_byte_in(0x40);
+    return (high << 8) | low;
+}
+
+static timer_source_t pit_source = {
+    "PIT", 0, 0xFFFF, pit_periodic, pit_oneshot, pit_read_count
+};
+
+/* What raises the tick interrupt */
+static timer_source_t *source = &pit_source;
+
+/* Ticks until the first pending timer, at most 'limit' */
+static u32 ticks_to_next_timer(u32 limit) {
+    u32 next = limit;
+    for (u32 b = 0; b < TIMER_WHEEL_SIZE; b++) {
+        for (ktimer_t *timer = timer_wheel[b]; timer; timer = timer->next) {
+            u32 left = timer->expires - tick;
+            if (left < next) next = left;
+        }
+    }
+    return next;
+}
+
+static void timer_callback(registers_t *regs) {
+    if (oneshot_ticks) {
+        /* Idle sleep over: back to periodic ticks */
+        u32 ticks = oneshot_ticks;
+        oneshot_ticks = 0;
+        source->periodic(source->count_per_tick);
+        ticks_skipped += ticks - 1;
+        advance_ticks(ticks);
+    } else {
+        advance_ticks(1);
+    }
     UNUSED(regs);
 }
 
+/* Called by the idle task with interrupts off, right before it halts.
+ * Rather than waking every tick, sleep until the next timer is due.
+ * The PIT's 16-bit count is already its largest divider: 65535 counts
+ * are about 55 ms, which is only 2 whole ticks at TIMER_HZ 50. So without
+ * a local APIC the idle task still wakes every other tick, half as often
+ * as periodic mode. The APIC timer sleeps up to TIMER_MAX_IDLE_TICKS */
+void timer_enter_idle(void) {
+    if (oneshot_ticks || !source->count_per_tick) return;
+
+    u32 limit = source->max_count / source->count_per_tick;
+    if (limit > TIMER_MAX_IDLE_TICKS) limit = TIMER_MAX_IDLE_TICKS;
+    u32 ticks = ticks_to_next_timer(limit);
+    if (ticks < 2) return;
+
+    oneshot_ticks = ticks;
+    oneshot_count = ticks * source->count_per_tick;
+    source->oneshot(oneshot_count);
+}
+
+/* Something other than the timer ended the sleep (interrupts off):
+ * account the whole ticks that passed and finish the current one with a
+ * short one-shot, so the tick phase is kept */
+void timer_exit_idle(void) {
+    if (oneshot_ticks < 2) return;
+
+    u32 left = source->read_count();
+    if (left == 0 || left > oneshot_count) {
+        /* Ran out already, the IRQ is pending and accounts it */
+        return;
+    }
+    u32 elapsed = oneshot_count - left;
+    u32 whole = elapsed / source->count_per_tick;
+    u32 partial = elapsed % source->count_per_tick;
+
+    oneshot_ticks = 1;
+    oneshot_count = source->count_per_tick - partial;
+    source->oneshot(oneshot_count);
+
+    if (whole) {
+        ticks_skipped += whole;
+        advance_ticks(whole);
+    }
+}
+
+/* Ticks that passed without a timer interrupt */
+u32 timer_ticks_skipped(void) {
+    return ticks_skipped;
+}
+
 void init_timer(u32 freq) {
     /* Install the function we just wrote */
     register_interrupt_handler(IRQ0, timer_callback);
 
     /* Get the PIT value: hardware clock at 1193180 Hz */
-    u32 divisor = 1193180 / freq;
-    u8 low  = (u8)(divisor & 0xFF);
-    u8 high = (u8)( (divisor >> 8) & 0xFF);
-    /* Send the command */
-    port_byte_out(0x43, 0x36); /* Command port */
-    port_byte_out(0x40, low);
-    port_byte_out(0x40, high);
+    pit_source.count_per_tick = PIT_FREQUENCY / freq;
+    pit_periodic(pit_source.count_per_tick);
+}
+
+/* Let another device raise the tick, periodic from now on. The old one
+ * keeps running: its interrupt line is the caller's to mask */
+void timer_set_source(timer_source_t *new_source) {
+    u32 flags = irq_save();
+    oneshot_ticks = 0;
+    source = new_source;
+    source->periodic(source->count_per_tick);
+    irq_restore(flags);
+}
+
+const char *timer_source_name(void) {
+    return source->name;
 }
 
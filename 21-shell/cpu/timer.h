@@ -3,7 +3,45 @@
 
 #include "types.h"
 
+#define TIMER_HZ 50
+
+/* Timer wheel: one bucket per tick modulo the wheel size, timers further
+ * out than one turn simply stay in their bucket for another round */
+#define TIMER_WHEEL_SIZE 64
+
+/* One-shot timer, embedded in whatever object it belongs to. The callback
+ * runs from the timer interrupt, so it must be short and must not block */
+typedef struct ktimer {
+    u32 expires;                  /* Tick at which the timer fires */
+    void (*callback)(void *data);
+    void *data;
+    struct ktimer *next;
+    struct ktimer *prev;
+    int pending;
+} ktimer_t;
+
+/* Device behind the tick. Counts are in the device's own units */
+typedef struct {
+    const char *name;
+    u32 count_per_tick;
+    u32 max_count;
+    void (*periodic)(u32 count);   /* Interrupt every 'count' */
+    void (*oneshot)(u32 count);    /* One interrupt after 'count' */
+    u32 (*read_count)(void);       /* What is left of a one-shot */
+} timer_source_t;
+
 extern u32 tick;
 void init_timer(u32 freq);
+void timer_set_source(timer_source_t *source);
+const char *timer_source_name(void);
+
+/* Tickless idle: only the idle task calls these, interrupts off */
+void timer_enter_idle(void);
+void timer_exit_idle(void);
+u32 timer_ticks_skipped(void);
+
+void timer_add(ktimer_t *timer, u32 ticks, void (*callback)(void *data), void *data);
+void timer_cancel(ktimer_t *timer);
+u32 timer_ms_to_ticks(u32 ms);
 
 #endif
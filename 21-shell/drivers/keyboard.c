@@ -1,58 +1,285 @@
 #include "keyboard.h"
+#include "keymap.h"
 #include "../cpu/ports.h"
 #include "../cpu/isr.h"
-#include "screen.h"
-#include "../libc/string.h"
 #include "../libc/function.h"
-#include "../kernel/kernel.h"
-
-#define BACKSPACE 0x0E
-#define ENTER 0x1C
-
-static char key_buffer[256];
-
-#define SC_MAX 57
-const char *sc_name[] = { "ERROR", "Esc", "1", "2", "3", "4", "5", "6", 
-    "7", "8", "9", "0", "-", "=", "Backspace", "Tab", "Q", "W", "E", 
-        "R", "T", "Y", "U", "I", "O", "P", "[", "]", "Enter", "Lctrl", 
-        "A", "S", "D", "F", "G", "H", "J", "K", "L", ";", "'", "`", 
-        "LShift", "\\", "Z", "X", "C", "V", "B", "N", "M", ",", ".", 
-        "/", "RShift", "Keypad *", "LAlt", "Spacebar"};
-const char sc_ascii[] = { '?', '?', '1', '2', '3', '4', '5', '6',     
-    '7', '8', '9', '0', '-', '=', '?', '?', 'Q', 'W', 'E', 'R', 'T', 'Y', 
-        'U', 'I', 'O', 'P', '[', ']', '?', '?', 'A', 'S', 'D', 'F', 'G', 
-        'H', 'J', 'K', 'L', ';', '\'', '`', '?', '\\', 'Z', 'X', 'C', 'V', 
-        'B', 'N', 'M', ',', '.', '/', '?', '?', '?', ' '};
-
-static void keyboard_callback(registers_t regs) {
-    /* The PIC leaves us the scancode in port 0x60 */
-    u8 scancode = port_byte_in(0x60);
-    
-    /* Handle key release events (scancode > 0x80) */
-    if (scancode > 0x80) {
+#include "../kernel/process.h"
+
+/* 8042 controller */
+#define KBD_DATA            0x60
+#define KBD_STATUS          0x64
+#define KBD_COMMAND         0x64
+#define KBD_STATUS_OUTPUT   0x01
+#define KBD_STATUS_INPUT    0x02
+#define KBD_READ_CONFIG     0x20
+#define KBD_CONFIG_XLATE    0x40  /* Controller translates set 2 to set 1 */
+#define KBD_SPIN_LIMIT      100000
+
+/* Prefix and protocol bytes, everything else is a key */
+#define SC_EXTENDED   0xE0
+#define SC_PAUSE      0xE1
+#define SC2_RELEASE   0xF0
+#define SC_ACK        0xFA
+#define SC_RESEND     0xFE
+#define SC_ERROR      0xFF
+
+/* Keyboards wrap some E0 keys (Print Screen, the cursor block with Num
+ * Lock on) in E0-prefixed Shift codes so the host can undo the Shift
+ * state. They are not keys and must not touch the modifiers */
+#define KEY_FAKE_LSHIFT (KEY_EXTENDED | KEY_LSHIFT)
+#define KEY_FAKE_RSHIFT (KEY_EXTENDED | KEY_RSHIFT)
+
+/* Bytes after E1 that only spell out Pause, which has no release */
+#define SET1_PAUSE_BYTES 5
+#define SET2_PAUSE_BYTES 7
+
+/* Set 2 make code to set 1 make code, what the controller's translation
+ * does. E0 keys translate with the same table */
+static const u8 set2_to_set1[0x84] = {
+    [0x01] = 0x43, [0x03] = 0x3F, [0x04] = 0x3D, [0x05] = 0x3B,
+    [0x06] = 0x3C, [0x07] = 0x58, [0x09] = 0x44, [0x0A] = 0x42,
+    [0x0B] = 0x40, [0x0C] = 0x3E, [0x0D] = 0x0F, [0x0E] = 0x29,
+    [0x11] = 0x38, [0x12] = 0x2A, [0x14] = 0x1D, [0x15] = 0x10,
+    [0x16] = 0x02, [0x1A] = 0x2C, [0x1B] = 0x1F, [0x1C] = 0x1E,
+    [0x1D] = 0x11, [0x1E] = 0x03, [0x1F] = 0x5B, [0x21] = 0x2E,
+    [0x22] = 0x2D, [0x23] = 0x20, [0x24] = 0x12, [0x25] = 0x05,
+    [0x26] = 0x04, [0x27] = 0x5C, [0x29] = 0x39, [0x2A] = 0x2F,
+    [0x2B] = 0x21, [0x2C] = 0x14, [0x2D] = 0x13, [0x2E] = 0x06,
+    [0x2F] = 0x5D, [0x31] = 0x31, [0x32] = 0x30, [0x33] = 0x23,
+    [0x34] = 0x22, [0x35] = 0x15, [0x36] = 0x07, [0x3A] = 0x32,
+    [0x3B] = 0x24, [0x3C] = 0x16, [0x3D] = 0x08, [0x3E] = 0x09,
+    [0x41] = 0x33, [0x42] = 0x25, [0x43] = 0x17, [0x44] = 0x18,
+    [0x45] = 0x0B, [0x46] = 0x0A, [0x49] = 0x34, [0x4A] = 0x35,
+    [0x4B] = 0x26, [0x4C] = 0x27, [0x4D] = 0x19, [0x4E] = 0x0C,
+    [0x52] = 0x28, [0x54] = 0x1A, [0x55] = 0x0D, [0x58] = 0x3A,
+    [0x59] = 0x36, [0x5A] = 0x1C, [0x5B] = 0x1B, [0x5D] = 0x2B,
+    [0x61] = 0x56, [0x66] = 0x0E, [0x69] = 0x4F, [0x6B] = 0x4B,
+    [0x6C] = 0x47, [0x70] = 0x52, [0x71] = 0x53, [0x72] = 0x50,
+    [0x73] = 0x4C, [0x74] = 0x4D, [0x75] = 0x48, [0x76] = 0x01,
+    [0x77] = 0x45, [0x78] = 0x57, [0x79] = 0x4E, [0x7A] = 0x51,
+    [0x7B] = 0x4A, [0x7C] = 0x37, [0x7D] = 0x49, [0x7E] = 0x46,
+    [0x83] = 0x41,
+};
+
+/* What each key does to the modifier state: the KEY_MOD_* bit it holds
+ * down or toggles. Keypad keys that double as cursor keys are marked */
+#define KEY_IS_KEYPAD 0x80
+static const u8 key_flags[256] = {
+    [KEY_LSHIFT] = KEY_MOD_SHIFT, [KEY_RSHIFT] = KEY_MOD_SHIFT,
+    [KEY_LCTRL] = KEY_MOD_CTRL, [KEY_RCTRL] = KEY_MOD_CTRL,
+    [KEY_LALT] = KEY_MOD_ALT, [KEY_RALT] = KEY_MOD_ALT,
+    [KEY_CAPSLOCK] = KEY_MOD_CAPS, [KEY_NUMLOCK] = KEY_MOD_NUM,
+    [KEY_SCROLLLOCK] = KEY_MOD_SCROLL,
+    [0x47] = KEY_IS_KEYPAD, [0x48] = KEY_IS_KEYPAD, [0x49] = KEY_IS_KEYPAD,
+    [0x4B] = KEY_IS_KEYPAD, [0x4D] = KEY_IS_KEYPAD, [0x4F] = KEY_IS_KEYPAD,
+    [0x50] = KEY_IS_KEYPAD, [0x51] = KEY_IS_KEYPAD, [0x52] = KEY_IS_KEYPAD,
+    [0x53] = KEY_IS_KEYPAD,
+};
+
+#define KEY_MOD_LOCKS (KEY_MOD_CAPS | KEY_MOD_NUM | KEY_MOD_SCROLL)
+
+/* Keys that hold a modifier: left and right count as one */
+static const u8 modifier_keys[] = {
+    KEY_LSHIFT, KEY_RSHIFT, KEY_LCTRL, KEY_RCTRL, KEY_LALT, KEY_RALT
+};
+
+/* Decoder state, only touched by the IRQ handler */
+static int scancode_set = 1;
+static u8 extended = 0;         /* KEY_EXTENDED after an E0 prefix */
+static u8 released = 0;         /* Set 2: an F0 prefix came */
+static u8 skip_bytes = 0;       /* Rest of a Pause sequence */
+static u8 modifiers = 0;
+static u32 keys_down[8];        /* Bitmap by key code, spots repeats */
+static const keymap_t *keymap = &KEYMAP_DEFAULT;
+
+/* Decoded events from the IRQ handler (the only producer) to the
+ * reading process (the only consumer). Each side writes just its own
+ * index and both indices only grow, so neither needs a lock; the size is
+ * a power of two so a paste burst fits before anything is dropped */
+#define KEY_RING_SIZE 256
+static key_event_t key_ring[KEY_RING_SIZE];
+static volatile u32 key_head = 0;
+static volatile u32 key_tail = 0;
+static u32 keys_dropped = 0;
+
+/* Process sleeping in keyboard_read_event(), -1 if none */
+static volatile int reader_pid = -1;
+
+/* Keep the slot access on its side of the index update */
+#define ring_barrier() asm volatile("" : : : "memory")
+
+/* Oldest event in the ring, 0 when it is empty */
+static int read_key(key_event_t *event) {
+    u32 tail = key_tail;
+    if (tail == key_head) return 0;
+    ring_barrier();
+    *event = key_ring[tail % KEY_RING_SIZE];
+    ring_barrier();
+    key_tail = tail + 1;
+    return 1;
+}
+
+/* The ring is checked again with interrupts off before blocking, so a
+ * key arriving in between wakes us instead of being missed */
+void keyboard_read_event(key_event_t *event) {
+    while (!read_key(event)) {
+        u32 flags = irq_save();
+        if (key_tail == key_head) {
+            reader_pid = get_current_pid();
+            block_process(reader_pid);
+            wait_until_unblocked();
+            reader_pid = -1;
+        }
+        irq_restore(flags);
+    }
+}
+
+u32 keyboard_dropped(void) {
+    return keys_dropped;
+}
+
+static void push_key(u8 keycode, u8 flags) {
+    u32 head = key_head;
+    if (head - key_tail >= KEY_RING_SIZE) {
+        keys_dropped++;
         return;
     }
-    
-    if (scancode > SC_MAX) {
+
+    /* Caps Lock only shifts letters, Ctrl makes them control characters */
+    char c = keymap->normal[keycode];
+    int letter = (c >= 'a' && c <= 'z');
+    int shifted = ((modifiers & KEY_MOD_SHIFT) != 0) ^ (letter && (modifiers & KEY_MOD_CAPS));
+    if (shifted) c = keymap->shift[keycode];
+    if (letter && (modifiers & KEY_MOD_CTRL)) c &= 0x1F;
+
+    key_event_t *event = &key_ring[head % KEY_RING_SIZE];
+    event->keycode = keycode;
+    event->flags = flags;
+    event->modifiers = modifiers;
+    event->ascii = c;
+    ring_barrier();
+    key_head = head + 1;
+}
+
+/* One complete key: modifier bookkeeping is all table lookups */
+static void key_event(u8 keycode, int pressed) {
+    u8 flags = key_flags[keycode];
+    u8 held = flags & ~(KEY_MOD_LOCKS | KEY_IS_KEYPAD);
+    u32 *down = &keys_down[keycode >> 5];
+    u32 bit = 1u << (keycode & 31);
+    int repeat = pressed && (*down & bit);
+
+    if (pressed) {
+        *down |= bit;
+        if (!repeat) modifiers ^= flags & KEY_MOD_LOCKS;
+    } else {
+        *down &= ~bit;
+    }
+    if (held) {
+        /* Letting go of one Shift keeps the other one in effect */
+        modifiers &= KEY_MOD_LOCKS;
+        for (u32 i = 0; i < sizeof(modifier_keys); i++) {
+            u8 key = modifier_keys[i];
+            if (keys_down[key >> 5] & (1u << (key & 31))) modifiers |= key_flags[key];
+        }
+    }
+
+    /* Without Num Lock the keypad is the cursor block */
+    if ((flags & KEY_IS_KEYPAD) && !(modifiers & KEY_MOD_NUM)) {
+        keycode |= KEY_EXTENDED;
+    }
+
+    push_key(keycode, (pressed ? KEY_EVENT_PRESSED : 0) | (repeat ? KEY_EVENT_REPEAT : 0));
+}
+
+/* Feed one byte from the controller through the decoder */
+static void decode_byte(u8 byte) {
+    if (skip_bytes) {
+        skip_bytes--;
         return;
     }
-    if (scancode == BACKSPACE) {
-        backspace(key_buffer);
-        kprint_backspace();
-    } else if (scancode == ENTER) {
-        kprint("\n");
-        user_input(key_buffer); /* kernel-controlled function */
-        key_buffer[0] = '\0';
+
+    switch (byte) {
+        case SC_EXTENDED:
+            extended = KEY_EXTENDED;
+            return;
+        case SC_PAUSE:
+            skip_bytes = (scancode_set == 1) ? SET1_PAUSE_BYTES : SET2_PAUSE_BYTES;
+            return;
+        case SC2_RELEASE:
+            if (scancode_set == 2) {
+                released = 1;
+                return;
+            }
+            break;
+        case 0x00: case SC_ACK: case SC_RESEND: case SC_ERROR:
+            return;
+    }
+
+    u8 keycode;
+    int pressed;
+    if (scancode_set == 1) {
+        keycode = (byte & 0x7F) | extended;
+        pressed = !(byte & 0x80);
     } else {
-        char letter = sc_ascii[(int)scancode];
-        /* Remember that kprint only accepts char[] */
-        char str[2] = {letter, '\0'};
-        append(key_buffer, letter);
-        kprint(str);
+        keycode = (byte < sizeof(set2_to_set1)) ? set2_to_set1[byte] : 0;
+        keycode |= keycode ? extended : 0;
+        pressed = !released;
+    }
+    extended = 0;
+    released = 0;
+
+    if (keycode == KEY_FAKE_LSHIFT || keycode == KEY_FAKE_RSHIFT) return;
+    if (keycode) key_event(keycode, pressed);
+}
+
+static void keyboard_callback(registers_t *regs) {
+    u32 head = key_head;
+    decode_byte(port_byte_in(KBD_DATA));
+
+    /* Run the reader soon: the top level preempts whatever the
+     * interrupt cut into on the way out. Prefix bytes wake nobody */
+    int pid = reader_pid;
+    if (pid >= 0 && key_head != head) {
+        boost_process(pid, 0);
+        unblock_process(pid);
     }
     UNUSED(regs);
 }
 
+/* Wait for the controller to have a byte for us; 0 on timeout */
+static int wait_output(void) {
+    for (int spins = 0; spins < KBD_SPIN_LIMIT; spins++) {
+        if (port_byte_in(KBD_STATUS) & KBD_STATUS_OUTPUT) return 1;
+    }
+    return 0;
+}
+
+static int wait_input(void) {
+    for (int spins = 0; spins < KBD_SPIN_LIMIT; spins++) {
+        if (!(port_byte_in(KBD_STATUS) & KBD_STATUS_INPUT)) return 1;
+    }
+    return 0;
+}
+
+/* Keyboards power up in set 2; the controller hands us set 1 unless its
+ * translation is off */
+static int detect_scancode_set(void) {
+    u32 flags = irq_save();
+    for (int i = 0; i < 16 && (port_byte_in(KBD_STATUS) & KBD_STATUS_OUTPUT); i++) {
+        port_byte_in(KBD_DATA);  /* Stale keys */
+    }
+
+    int set = 1;
+    if (wait_input()) {
+        port_byte_out(KBD_COMMAND, KBD_READ_CONFIG);
+        if (wait_output() && !(port_byte_in(KBD_DATA) & KBD_CONFIG_XLATE)) set = 2;
+    }
+    irq_restore(flags);
+    return set;
+}
+
 void init_keyboard() {
-   register_interrupt_handler(IRQ1, keyboard_callback); 
+   scancode_set = detect_scancode_set();
+   register_interrupt_handler(IRQ1, keyboard_callback);
 }
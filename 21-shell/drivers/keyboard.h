@@ -1,3 +1,64 @@
 #include "../cpu/types.h"
 
+/* Key codes are scancode set 1 make codes; keys that come after an E0
+ * prefix get bit 7 set. Set 2 keyboards are translated to the same codes */
+#define KEY_EXTENDED   0x80
+
+#define KEY_ESC        0x01
+#define KEY_BACKSPACE  0x0E
+#define KEY_TAB        0x0F
+#define KEY_ENTER      0x1C
+#define KEY_LCTRL      0x1D
+#define KEY_LSHIFT     0x2A
+#define KEY_RSHIFT     0x36
+#define KEY_LALT       0x38
+#define KEY_SPACE      0x39
+#define KEY_CAPSLOCK   0x3A
+#define KEY_F1         0x3B
+#define KEY_F10        0x44
+#define KEY_NUMLOCK    0x45
+#define KEY_SCROLLLOCK 0x46
+#define KEY_F11        0x57
+#define KEY_F12        0x58
+
+#define KEY_KP_ENTER   (KEY_EXTENDED | 0x1C)
+#define KEY_RCTRL      (KEY_EXTENDED | 0x1D)
+#define KEY_KP_SLASH   (KEY_EXTENDED | 0x35)
+#define KEY_RALT       (KEY_EXTENDED | 0x38)
+#define KEY_HOME       (KEY_EXTENDED | 0x47)
+#define KEY_UP         (KEY_EXTENDED | 0x48)
+#define KEY_PGUP       (KEY_EXTENDED | 0x49)
+#define KEY_LEFT       (KEY_EXTENDED | 0x4B)
+#define KEY_RIGHT      (KEY_EXTENDED | 0x4D)
+#define KEY_END        (KEY_EXTENDED | 0x4F)
+#define KEY_DOWN       (KEY_EXTENDED | 0x50)
+#define KEY_PGDN       (KEY_EXTENDED | 0x51)
+#define KEY_INSERT     (KEY_EXTENDED | 0x52)
+#define KEY_DELETE     (KEY_EXTENDED | 0x53)
+
+/* Modifier state carried by every event */
+#define KEY_MOD_SHIFT  0x01
+#define KEY_MOD_CTRL   0x02
+#define KEY_MOD_ALT    0x04
+#define KEY_MOD_CAPS   0x10  /* Lock states */
+#define KEY_MOD_NUM    0x20
+#define KEY_MOD_SCROLL 0x40
+
+#define KEY_EVENT_PRESSED 0x01
+#define KEY_EVENT_REPEAT  0x02  /* Typematic repeat of a key held down */
+
+typedef struct {
+    u8 keycode;
+    u8 flags;      /* KEY_EVENT_* */
+    u8 modifiers;  /* KEY_MOD_* after this key took effect */
+    char ascii;    /* Character from the keymap, 0 if the key has none */
+} key_event_t;
+
 void init_keyboard();
+
+/* Next key press or release. Blocks the caller until there is one; only
+ * one process reads the keyboard */
+void keyboard_read_event(key_event_t *event);
+
+/* Key events lost because the reader fell a whole ring behind */
+u32 keyboard_dropped(void);
@@ -0,0 +1,64 @@
+#include "keymap.h"
+#include "keyboard.h"
+
+/* Keypad keys give digits here; the driver moves them to their extended
+ * (cursor) codes while Num Lock is off */
+#define KEYPAD_NORMAL \
+    [0x47] = '7', [0x48] = '8', [0x49] = '9', [0x4A] = '-', \
+    [0x4B] = '4', [0x4C] = '5', [0x4D] = '6', [0x4E] = '+', [0x4F] = '1', \
+    [0x50] = '2', [0x51] = '3', [0x52] = '0', [0x53] = '.', \
+    [KEY_KP_ENTER] = '\n', [KEY_KP_SLASH] = '/'
+
+const keymap_t keymap_us = {
+    "US",
+    {
+        0, 0x1B, '1', '2', '3', '4', '5', '6',
+        '7', '8', '9', '0', '-', '=', '\b', '\t',
+        'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
+        'o', 'p', '[', ']', '\n', 0, 'a', 's',
+        'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',
+        '\'', '`', 0, '\\', 'z', 'x', 'c', 'v',
+        'b', 'n', 'm', ',', '.', '/', 0, '*',
+        0, ' ', [0x56] = '\\',
+        KEYPAD_NORMAL
+    },
+    {
+        0, 0x1B, '!', '@', '#', '$', '%', '^',
+        '&', '*', '(', ')', '_', '+', '\b', '\t',
+        'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I',
+        'O', 'P', '{', '}', '\n', 0, 'A', 'S',
+        'D', 'F', 'G', 'H', 'J', 'K', 'L', ':',
+        '"', '~', 0, '|', 'Z', 'X', 'C', 'V',
+        'B', 'N', 'M', '<', '>', '?', 0, '*',
+        0, ' ', [0x56] = '|',
+        KEYPAD_NORMAL
+    }
+};
+
+/* '#' has its own key next to Enter and the extra key by Left Shift is
+ * '\'. Pound and not-sign are code page 437 characters */
+const keymap_t keymap_uk = {
+    "UK",
+    {
+        0, 0x1B, '1', '2', '3', '4', '5', '6',
+        '7', '8', '9', '0', '-', '=', '\b', '\t',
+        'q', 'w', 'e', 'r', 't', 'y', 'u', 'i',
+        'o', 'p', '[', ']', '\n', 0, 'a', 's',
+        'd', 'f', 'g', 'h', 'j', 'k', 'l', ';',
+        '\'', '`', 0, '#', 'z', 'x', 'c', 'v',
+        'b', 'n', 'm', ',', '.', '/', 0, '*',
+        0, ' ', [0x56] = '\\',
+        KEYPAD_NORMAL
+    },
+    {
+        0, 0x1B, '!', '"', (char)0x9C, '$', '%', '^',
+        '&', '*', '(', ')', '_', '+', '\b', '\t',
+        'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I',
+        'O', 'P', '{', '}', '\n', 0, 'A', 'S',
+        'D', 'F', 'G', 'H', 'J', 'K', 'L', ':',
+        '@', (char)0xAA, 0, '~', 'Z', 'X', 'C', 'V',
+        'B', 'N', 'M', '<', '>', '?', 0, '*',
+        0, ' ', [0x56] = '|',
+        KEYPAD_NORMAL
+    }
+};
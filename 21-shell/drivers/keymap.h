@@ -0,0 +1,24 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include "../cpu/types.h"
+
+/* Characters per key code (see keyboard.h), without and with Shift. Caps
+ * Lock acts as Shift on the keys whose plain character is a letter, Ctrl
+ * turns letters into control characters. 0 means no character */
+typedef struct {
+    const char *name;
+    char normal[256];
+    char shift[256];
+} keymap_t;
+
+extern const keymap_t keymap_us;
+extern const keymap_t keymap_uk;
+
+/* Layout the driver starts with; build with -DKEYMAP_DEFAULT=keymap_uk
+ * for another one */
+#ifndef KEYMAP_DEFAULT
+#define KEYMAP_DEFAULT keymap_us
+#endif
+
+#endif
@@ -1,6 +1,7 @@
 #include "screen.h"
 #include "../cpu/ports.h"
 #include "../libc/mem.h"
+#include "../cpu/isr.h"
 
 /* Declaration of private functions */
 int get_cursor_offset();
@@ -17,8 +18,12 @@ int get_offset_col(int offset);
 /**
  * Print a message on the specified location
  * If col, row, are negative, we will use the current offset
+ * Runs with interrupts off, so output from different threads
+ * never interleaves within a message
  */
 void kprint_at(char *message, int col, int row) {
+    u32 flags = irq_save();
+
     /* Set cursor if col/row are negative */
     int offset;
     if (col >= 0 && row >= 0)
@@ -37,17 +42,32 @@ void kprint_at(char *message, int col, int row) {
         row = get_offset_row(offset);
         col = get_offset_col(offset);
     }
+
+    irq_restore(flags);
 }
 
 void kprint(char *message) {
     kprint_at(message, -1, -1);
 }
 
+/* Move the cursor 'cells' characters forward (negative: back), across
+ * line ends, without touching the text */
+void kprint_move_cursor(int cells) {
+    u32 flags = irq_save();
+    int offset = get_cursor_offset() + 2 * cells;
+    if (offset < 0) offset = 0;
+    if (offset >= 2 * MAX_COLS * MAX_ROWS) offset = 2 * MAX_COLS * MAX_ROWS - 2;
+    set_cursor_offset(offset);
+    irq_restore(flags);
+}
+
 void kprint_backspace() {
+    u32 flags = irq_save();
     int offset = get_cursor_offset()-2;
     int row = get_offset_row(offset);
     int col = get_offset_col(offset);
     print_char(0x08, col, row, WHITE_ON_BLACK);
+    irq_restore(flags);
 }
 
 
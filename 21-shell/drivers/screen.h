@@ -18,5 +18,6 @@ void clear_screen();
 void kprint_at(char *message, int col, int row);
 void kprint(char *message);
 void kprint_backspace();
+void kprint_move_cursor(int cells);
 
 #endif
@@ -0,0 +1,52 @@
+#include "serial.h"
+#include "../cpu/ports.h"
+
+/* 16550 registers, offsets from the base port */
+#define SERIAL_DATA        0
+#define SERIAL_INT_ENABLE  1
+#define SERIAL_FIFO_CTRL   2
+#define SERIAL_LINE_CTRL   3
+#define SERIAL_MODEM_CTRL  4
+#define SERIAL_LINE_STATUS 5
+
+#define SERIAL_LSR_THR_EMPTY 0x20
+
+static int serial_present = 0;
+
+/**
+ * 38400 baud, 8N1, FIFOs on, polled (no interrupts). The UART is put in
+ * loopback mode first to check that there is one at all
+ */
+int init_serial(void) {
+    u16 port = SERIAL_COM1;
+    port_byte_out(port + SERIAL_INT_ENABLE, 0x00);
+    port_byte_out(port + SERIAL_LINE_CTRL, 0x80);  /* DLAB on: divisor follows */
+    port_byte_out(port + SERIAL_DATA, 0x03);       /* 115200 / 3 */
+    port_byte_out(port + SERIAL_INT_ENABLE, 0x00);
+    port_byte_out(port + SERIAL_LINE_CTRL, 0x03);  /* 8 bits, no parity, 1 stop */
+    port_byte_out(port + SERIAL_FIFO_CTRL, 0xC7);
+    port_byte_out(port + SERIAL_MODEM_CTRL, 0x1E); /* Loopback */
+
+    port_byte_out(port + SERIAL_DATA, 0xAE);
+    if (port_byte_in(port + SERIAL_DATA) != 0xAE) {
+        serial_present = 0;
+        return 0;
+    }
+
+    port_byte_out(port + SERIAL_MODEM_CTRL, 0x0F);
+    serial_present = 1;
+    return 1;
+}
+
+void serial_write_char(char c) {
+    if (!serial_present) return;
+    while (!(port_byte_in(SERIAL_COM1 + SERIAL_LINE_STATUS) & SERIAL_LSR_THR_EMPTY));
+    port_byte_out(SERIAL_COM1 + SERIAL_DATA, c);
+}
+
+void serial_write(char *message) {
+    while (*message) {
+        if (*message == '\n') serial_write_char('\r');
+        serial_write_char(*message++);
+    }
+}
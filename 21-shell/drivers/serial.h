@@ -0,0 +1,13 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "../cpu/types.h"
+
+#define SERIAL_COM1 0x3F8
+
+/* Returns 0 if no UART answers on COM1 (writes are dropped then) */
+int init_serial(void);
+void serial_write_char(char c);
+void serial_write(char *message);
+
+#endif
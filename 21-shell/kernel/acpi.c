@@ -0,0 +1,223 @@
+#include "acpi.h"
+#include "multiboot2.h"
+#include "klog.h"
+#include "../cpu/paging.h"
+
+#define NULL ((void*)0)
+
+// Root System Description Pointer, revision 2 layout
+typedef struct {
+    char signature[8];   // "RSD PTR "
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_address;
+    u32 length;          // Revision 2 and later only
+    u64 xsdt_address;
+    u8 extended_checksum;
+    u8 reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    u32 lapic_address;
+    u32 flags;
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_PCAT_COMPAT 0x1
+
+// MADT entry types
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_ISO            2
+#define MADT_LAPIC_OVERRIDE 5
+
+#define MADT_LAPIC_ENABLED  0x1
+
+static int signature_is(const char *field, const char *signature, int length) {
+    for (int i = 0; i < length; i++) {
+        if (field[i] != signature[i]) return 0;
+    }
+    return 1;
+}
+
+static int checksum_ok(const void *table, u32 length) {
+    const u8 *bytes = (const u8*)table;
+    u8 sum = 0;
+    for (u32 i = 0; i < length; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+// Firmware often puts its tables in reserved memory above the top of
+// RAM, which the identity map does not cover. Map any page of the range
+// that is missing (uncached, like the APIC windows) before reading it;
+// pages already in the identity map keep their cached mapping. Only the
+// range below the user window qualifies
+static int reachable(u32 address, u32 length) {
+    if (address < PAGE_SIZE || length == 0 || address >= KERNEL_SPACE_END ||
+        length > KERNEL_SPACE_END - address) {
+        return 0;
+    }
+    u32 last = (address + length - 1) & PAGE_FRAME_MASK;
+    for (u32 page = address & PAGE_FRAME_MASK; page <= last; page += PAGE_SIZE) {
+        if (paging_get_entry(kernel_directory, page) & PAGE_PRESENT) continue;
+        if (!paging_map_mmio(page, PAGE_SIZE)) return 0;
+    }
+    return 1;
+}
+
+static acpi_rsdp_t *rsdp_at(u32 address) {
+    acpi_rsdp_t *rsdp = (acpi_rsdp_t*)address;
+    if (!reachable(address, sizeof(acpi_rsdp_t))) return NULL;
+    if (!signature_is(rsdp->signature, "RSD PTR ", 8) || !checksum_ok(rsdp, 20)) {
+        return NULL;
+    }
+    return rsdp;
+}
+
+// The loader hands over a copy of the RSDP (new one preferred)
+static acpi_rsdp_t *rsdp_from_multiboot2(void) {
+    if (multiboot2_magic != MULTIBOOT2_BOOTLOADER_MAGIC || !multiboot2_info) {
+        return NULL;
+    }
+    
+    acpi_rsdp_t *found = NULL;
+    u32 info = multiboot2_info;
+    u32 total_size = ((multiboot2_info_t*)info)->total_size;
+    u32 tag_addr = info + 8;
+    while (tag_addr < info + total_size) {
+        multiboot2_tag_t *tag = (multiboot2_tag_t*)tag_addr;
+        if (tag->type == MULTIBOOT2_TAG_TYPE_END) break;
+        
+        if (tag->type == MULTIBOOT2_TAG_TYPE_ACPI_NEW ||
+            (tag->type == MULTIBOOT2_TAG_TYPE_ACPI_OLD && !found)) {
+            acpi_rsdp_t *rsdp = rsdp_at(tag_addr + sizeof(multiboot2_tag_t));
+            if (rsdp) found = rsdp;
+        }
+        tag_addr += (tag->size + MULTIBOOT2_TAG_ALIGN - 1) & ~(MULTIBOOT2_TAG_ALIGN - 1);
+    }
+    return found;
+}
+
+// Legacy BIOS search: the last KB of base memory (where the EBDA usually
+// is; the BDA pointer itself sits in the unmapped page 0) and the BIOS
+// ROM area, on 16-byte boundaries
+static acpi_rsdp_t *rsdp_from_bios(void) {
+    static const u32 ranges[][2] = {
+        { 0x9FC00, 0xA0000 },
+        { 0xE0000, 0x100000 },
+    };
+    for (u32 r = 0; r < 2; r++) {
+        for (u32 address = ranges[r][0]; address < ranges[r][1]; address += 16) {
+            acpi_rsdp_t *rsdp = rsdp_at(address);
+            if (rsdp) return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static acpi_sdt_header_t *table_at(u32 address) {
+    if (!reachable(address, sizeof(acpi_sdt_header_t))) return NULL;
+    acpi_sdt_header_t *table = (acpi_sdt_header_t*)address;
+    if (table->length < sizeof(acpi_sdt_header_t) ||
+        !reachable(address, table->length) || !checksum_ok(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+// Walk the XSDT (64-bit entries) when there is one below 4 GB, else the
+// RSDT (32-bit entries)
+static acpi_madt_t *find_madt(acpi_rsdp_t *rsdp) {
+    u32 entry_size = 4;
+    acpi_sdt_header_t *root = NULL;
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && !(rsdp->xsdt_address >> 32)) {
+        root = table_at((u32)rsdp->xsdt_address);
+        entry_size = 8;
+    }
+    if (!root) {
+        root = table_at(rsdp->rsdt_address);
+        entry_size = 4;
+    }
+    if (!root) return NULL;
+    
+    u32 entries = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    u8 *entry = (u8*)root + sizeof(acpi_sdt_header_t);
+    for (u32 i = 0; i < entries; i++, entry += entry_size) {
+        // Upper half of an XSDT entry must be 0 for us to reach it
+        if (entry_size == 8 && *(u32*)(entry + 4)) continue;
+        acpi_sdt_header_t *table = table_at(*(u32*)entry);
+        if (table && signature_is(table->signature, "APIC", 4)) {
+            return (acpi_madt_t*)table;
+        }
+    }
+    return NULL;
+}
+
+int acpi_parse_madt(acpi_madt_info_t *info) {
+    acpi_rsdp_t *rsdp = rsdp_from_multiboot2();
+    if (!rsdp) rsdp = rsdp_from_bios();
+    if (!rsdp) {
+        klog_info("ACPI: no RSDP found");
+        return 0;
+    }
+    
+    acpi_madt_t *madt = find_madt(rsdp);
+    if (!madt) {
+        klog_info("ACPI: no usable MADT");
+        return 0;
+    }
+    
+    info->lapic_address = madt->lapic_address;
+    info->legacy_pics = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    info->cpu_count = 0;
+    info->ioapic_count = 0;
+    for (u32 irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        info->isa_gsi[irq] = irq;   // Identity unless overridden
+        info->isa_flags[irq] = 0;
+    }
+    
+    u8 *entry = (u8*)madt + sizeof(acpi_madt_t);
+    u8 *end = (u8*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+            case MADT_LAPIC:
+                if (*(u32*)(entry + 4) & MADT_LAPIC_ENABLED) info->cpu_count++;
+                break;
+            case MADT_IOAPIC:
+                if (info->ioapic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapic_t *ioapic = &info->ioapics[info->ioapic_count++];
+                    ioapic->id = entry[2];
+                    ioapic->address = *(u32*)(entry + 4);
+                    ioapic->gsi_base = *(u32*)(entry + 8);
+                }
+                break;
+            case MADT_ISO:
+                // Only ISA (bus 0) sources are overridden
+                if (entry[2] == 0 && entry[3] < ACPI_ISA_IRQS) {
+                    info->isa_gsi[entry[3]] = *(u32*)(entry + 4);
+                    info->isa_flags[entry[3]] = *(u16*)(entry + 8);
+                }
+                break;
+            case MADT_LAPIC_OVERRIDE:
+                if (!*(u32*)(entry + 8)) info->lapic_address = *(u32*)(entry + 4);
+                break;
+        }
+        entry += entry[1];
+    }
+    
+    klog_info("ACPI: MADT with %u CPUs, %u IOAPICs", info->cpu_count, info->ioapic_count);
+    return info->ioapic_count > 0;
+}
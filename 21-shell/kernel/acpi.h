@@ -0,0 +1,36 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "../cpu/types.h"
+
+// What the interrupt controller setup needs from the ACPI MADT
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_ISA_IRQS    16
+
+// MPS INTI flags of an interrupt source override
+#define ACPI_POLARITY_MASK 0x3
+#define ACPI_POLARITY_LOW  0x3
+#define ACPI_TRIGGER_MASK  0xC
+#define ACPI_TRIGGER_LEVEL 0xC
+
+typedef struct {
+    u8 id;
+    u32 address;
+    u32 gsi_base;     // First global system interrupt it handles
+} acpi_ioapic_t;
+
+typedef struct {
+    u32 lapic_address;
+    int legacy_pics;                // Dual 8259 present too (PCAT_COMPAT)
+    u32 cpu_count;
+    u32 ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    u32 isa_gsi[ACPI_ISA_IRQS];     // ISA IRQ -> GSI, after overrides
+    u16 isa_flags[ACPI_ISA_IRQS];   // 0: ISA default (active high, edge)
+} acpi_madt_info_t;
+
+// Locate the RSDP (multiboot2 tags, then the BIOS areas), walk the
+// RSDT/XSDT and parse the MADT. Returns 0 without a usable MADT
+int acpi_parse_madt(acpi_madt_info_t *info);
+
+#endif // ACPI_H
@@ -5,9 +5,35 @@
 #include "../libc/mem.h"
 #include "process.h"
 #include "memory.h"
+#include "pmm.h"
+#include "../cpu/paging.h"
+#include "../cpu/clock.h"
+#include "../cpu/isr.h"
+#include "klog.h"
 
-// Global IPC system state
-static ipc_process_t ipc_processes[32]; // Support up to 32 processes
+// Bytes of a message in front of the inline payload
+#define IPC_MESSAGE_HEADER_SIZE __builtin_offsetof(ipc_message_t, data)
+
+// Open addressing hash table (linear probing, backward shift deletion).
+// Used for PID -> ipc_process_t and queue id -> ipc_queue_t, so lookups
+// cost the same however many processes use IPC. Empty entries have a
+// null value
+typedef struct {
+    u32 key;
+    void *value;
+} ipc_hash_entry_t;
+
+typedef struct {
+    ipc_hash_entry_t *entries;
+    u32 capacity;    // Power of two (0 before the first insert)
+    u32 count;
+} ipc_hash_t;
+
+// Global IPC system state. Senders, receivers and the timeout callback
+// run in different processes, so the tables, queues and buffers are only
+// changed with interrupts off (the public entry points take irq_save())
+static ipc_hash_t process_table;
+static ipc_hash_t queue_table;
 static u32 next_queue_id = 1;
 static u32 next_message_id = 1;
 static u32 total_queues_created = 0;
@@ -15,34 +41,179 @@ static u32 total_messages_sent = 0;
 static u32 total_messages_received = 0;
 static u32 total_messages_dropped = 0;
 static u32 total_broadcasts = 0;
-static u64 system_start_time = 0;
+static u64 system_start_time = 0;  // ktime_ns() at init
 
-// Initialize the IPC system
-void init_ipc_system(void) {
-    kprint("Initializing enhanced IPC system...\n");
-    
-    // Clear all IPC process structures
-    for (int i = 0; i < 32; i++) {
-        ipc_processes[i].pid = 0;
-        ipc_processes[i].queue_count = 0;
-        ipc_processes[i].pending_messages = 0;
-        ipc_processes[i].total_messages_sent = 0;
-        ipc_processes[i].total_messages_received = 0;
-        ipc_processes[i].priority = IPC_PRIORITY_NORMAL;
-        
-        // Clear all queues for this process
-        for (int j = 0; j < IPC_MAX_QUEUES_PER_PROCESS; j++) {
-            ipc_processes[i].queues[j].queue_id = 0;
-            ipc_processes[i].queues[j].owner_pid = 0;
-            ipc_processes[i].queues[j].max_messages = 0;
-            ipc_processes[i].queues[j].current_count = 0;
-            ipc_processes[i].queues[j].head = 0;
-            ipc_processes[i].queues[j].tail = 0;
-            ipc_processes[i].queues[j].status = IPC_QUEUE_EMPTY;
-            ipc_processes[i].queues[j].total_messages_processed = 0;
-            ipc_processes[i].queues[j].total_messages_dropped = 0;
+// Zero-copy buffer table, indexed by handle (slot 0 is never handed out
+// so 0 can mean "no buffer"). Free slots are chained through next_free
+typedef struct {
+    u32 phys;        // First frame of the run
+    u32 pages;       // 0 when the slot is free
+    u32 owner_pid;   // Current owner, the receiver while in flight
+    u32 addr;        // Where the owner sees the buffer, 0 while in flight
+    int region_id;   // Owner's VMA for user processes, -1 otherwise
+    u32 next_free;
+} ipc_buffer_t;
+
+static ipc_buffer_t *ipc_buffers = 0;
+static u32 ipc_buffer_capacity = 0;
+static u32 ipc_buffer_free_head = 0;
+
+static u32 hash_slot(ipc_hash_t *table, u32 key) {
+    key ^= key >> 16;
+    key *= 0x45D9F3B;
+    key ^= key >> 16;
+    return key & (table->capacity - 1);
+}
+
+static void* hash_get(ipc_hash_t *table, u32 key) {
+    if (!table->capacity) return 0;
+    
+    u32 mask = table->capacity - 1;
+    for (u32 i = hash_slot(table, key); table->entries[i].value; i = (i + 1) & mask) {
+        if (table->entries[i].key == key) {
+            return table->entries[i].value;
+        }
+    }
+    return 0;
+}
+
+// Insert a key known not to be present into a table with room for it
+static void hash_insert(ipc_hash_t *table, u32 key, void *value) {
+    u32 mask = table->capacity - 1;
+    u32 i = hash_slot(table, key);
+    while (table->entries[i].value) {
+        i = (i + 1) & mask;
+    }
+    table->entries[i].key = key;
+    table->entries[i].value = value;
+    table->count++;
+}
+
+static int hash_grow(ipc_hash_t *table) {
+    u32 capacity = table->capacity ? table->capacity * 2 : IPC_HASH_INITIAL;
+    ipc_hash_entry_t *entries = (ipc_hash_entry_t*)kmalloc(capacity * sizeof(ipc_hash_entry_t), 0, 0);
+    if (!entries) {
+        return 0;
+    }
+    memset(entries, 0, capacity * sizeof(ipc_hash_entry_t));
+    
+    ipc_hash_entry_t *old = table->entries;
+    u32 old_capacity = table->capacity;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->count = 0;
+    for (u32 i = 0; i < old_capacity; i++) {
+        if (old[i].value) {
+            hash_insert(table, old[i].key, old[i].value);
+        }
+    }
+    kfree((u32)old);
+    return 1;
+}
+
+// Add a new key, growing past 3/4 load. Returns 0 when out of memory
+static int hash_put(ipc_hash_t *table, u32 key, void *value) {
+    if ((table->count + 1) * 4 > table->capacity * 3 && !hash_grow(table)) {
+        return 0;
+    }
+    hash_insert(table, key, value);
+    return 1;
+}
+
+static void hash_remove(ipc_hash_t *table, u32 key) {
+    if (!table->capacity) return;
+    
+    u32 mask = table->capacity - 1;
+    u32 hole = hash_slot(table, key);
+    while (table->entries[hole].value && table->entries[hole].key != key) {
+        hole = (hole + 1) & mask;
+    }
+    if (!table->entries[hole].value) return;
+    
+    // Pull later members of the probe run back into the hole, unless
+    // their home slot lies between the hole and where they sit now
+    for (u32 j = (hole + 1) & mask; table->entries[j].value; j = (j + 1) & mask) {
+        u32 home = hash_slot(table, table->entries[j].key);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            table->entries[hole] = table->entries[j];
+            hole = j;
         }
     }
+    table->entries[hole].value = 0;
+    table->count--;
+}
+
+// Empty a queue and size its slot bitmap
+static void reset_queue(ipc_queue_t *queue, u32 max_messages) {
+    queue->max_messages = max_messages;
+    queue->current_count = 0;
+    queue->status = IPC_QUEUE_EMPTY;
+    queue->total_messages_processed = 0;
+    queue->total_messages_dropped = 0;
+    queue->free_slots = (1u << max_messages) - 1;
+    queue->ready_levels = 0;
+    for (int level = 0; level < IPC_PRIORITY_LEVELS; level++) {
+        queue->head[level] = 0;
+        queue->count[level] = 0;
+    }
+}
+
+// Ring a priority belongs to. Out of range priorities are clamped
+static u32 priority_level(u32 priority) {
+    if (priority < IPC_PRIORITY_LOW) priority = IPC_PRIORITY_LOW;
+    if (priority > IPC_PRIORITY_URGENT) priority = IPC_PRIORITY_URGENT;
+    return priority - IPC_PRIORITY_LOW;
+}
+
+// Claim a free slot (queue not full). It is not visible to receivers
+// until queue_push() links it
+static ipc_message_t* queue_claim(ipc_queue_t *queue) {
+    u32 slot = __builtin_ctz(queue->free_slots);
+    queue->free_slots &= ~(1u << slot);
+    return &queue->messages[slot];
+}
+
+// Append a claimed slot to the ring of its priority level
+static void queue_push(ipc_queue_t *queue, u32 level, ipc_message_t *msg) {
+    u32 tail = (queue->head[level] + queue->count[level]) % IPC_MAX_MESSAGES_PER_QUEUE;
+    queue->ring[level][tail] = msg - queue->messages;
+    queue->count[level]++;
+    queue->ready_levels |= 1u << level;
+    
+    queue->current_count++;
+    queue->status = queue->current_count >= queue->max_messages ?
+                    IPC_QUEUE_FULL : IPC_QUEUE_HAS_MESSAGES;
+}
+
+// Unlink the oldest message of the highest non-empty level (queue not
+// empty). The slot stays allocated until queue_release() so the caller
+// can copy it out first
+static u32 queue_pop(ipc_queue_t *queue) {
+    u32 level = 31 - __builtin_clz(queue->ready_levels);
+    u32 slot = queue->ring[level][queue->head[level]];
+    queue->head[level] = (queue->head[level] + 1) % IPC_MAX_MESSAGES_PER_QUEUE;
+    if (--queue->count[level] == 0) {
+        queue->ready_levels &= ~(1u << level);
+    }
+    
+    queue->current_count--;
+    queue->status = queue->current_count ? IPC_QUEUE_HAS_MESSAGES : IPC_QUEUE_EMPTY;
+    return slot;
+}
+
+static void queue_release(ipc_queue_t *queue, u32 slot) {
+    queue->free_slots |= 1u << slot;
+}
+
+// Initialize the IPC system
+void init_ipc_system(void) {
+    // Process entries and queues are allocated on demand
+    process_table.entries = 0;
+    process_table.capacity = 0;
+    process_table.count = 0;
+    queue_table.entries = 0;
+    queue_table.capacity = 0;
+    queue_table.count = 0;
     
     next_queue_id = 1;
     next_message_id = 1;
@@ -51,121 +222,374 @@ void init_ipc_system(void) {
     total_messages_received = 0;
     total_messages_dropped = 0;
     total_broadcasts = 0;
-    system_start_time = 0; // Will be set by timer
+    system_start_time = ktime_ns();
     
-    kprint("Enhanced IPC system initialized successfully!\n");
+    klog_info("IPC system initialized");
 }
 
 // Find IPC process structure by PID
 static ipc_process_t* find_ipc_process(u32 pid) {
-    for (int i = 0; i < 32; i++) {
-        if (ipc_processes[i].pid == pid) {
-            return &ipc_processes[i];
-        }
-    }
-    return 0;
+    return (ipc_process_t*)hash_get(&process_table, pid);
 }
 
 // Create a new IPC process entry
 static ipc_process_t* create_ipc_process(u32 pid) {
-    for (int i = 0; i < 32; i++) {
-        if (ipc_processes[i].pid == 0) {
-            ipc_processes[i].pid = pid;
-            ipc_processes[i].queue_count = 0;
-            ipc_processes[i].pending_messages = 0;
-            ipc_processes[i].total_messages_sent = 0;
-            ipc_processes[i].total_messages_received = 0;
-            ipc_processes[i].priority = IPC_PRIORITY_NORMAL;
-            return &ipc_processes[i];
+    ipc_process_t *proc = (ipc_process_t*)kmalloc(sizeof(ipc_process_t), 0, 0);
+    if (!proc) {
+        return 0;
+    }
+    memset(proc, 0, sizeof(ipc_process_t));
+    proc->pid = pid;
+    proc->priority = IPC_PRIORITY_NORMAL;
+    
+    if (!hash_put(&process_table, pid, proc)) {
+        kfree((u32)proc);
+        return 0;
+    }
+    return proc;
+}
+
+// Scheduler level a receiver is lifted to when a message wakes it
+static int wake_level(u32 priority) {
+    if (priority >= IPC_PRIORITY_HIGH) return 0;
+    return priority == IPC_PRIORITY_NORMAL ? 1 : 2;
+}
+
+// Make a receiver blocked in ipc_receive_with_timeout() runnable again
+static void wake_receiver(ipc_process_t *proc) {
+    if (proc->waiting) {
+        proc->waiting = 0;
+        timer_cancel(&proc->timeout);
+        boost_process(proc->pid, wake_level(proc->priority));
+        unblock_process(proc->pid);
+    }
+}
+
+// Timer wheel callback, runs in interrupt context
+static void receive_timeout(void *data) {
+    wake_receiver((ipc_process_t*)data);
+}
+
+static ipc_queue_t* find_ready_queue(ipc_process_t *proc) {
+    for (int i = 0; i < IPC_MAX_QUEUES_PER_PROCESS; i++) {
+        if (proc->queues[i] && proc->queues[i]->current_count > 0) {
+            return proc->queues[i];
         }
     }
     return 0;
 }
 
-// Create an IPC queue for a process
-u32 ipc_create_queue(u32 pid, u32 max_messages) {
+// Block the current process until a sender or the timeout wakes it.
+// Returns the process entry again, 0 if it was cleaned up meanwhile
+static ipc_process_t* wait_for_message(ipc_process_t *proc, u32 timeout_ms) {
+    u32 pid = proc->pid;
+    u64 wait_start = ktime_ns();
+    u64 deadline = wait_start + (u64)timeout_ms * NSEC_PER_MSEC;
+    
+    // The timer wheel counts whole ticks from a tick that is already
+    // partly gone, so it can fire early: the clocksource decides whether
+    // the timeout really passed, otherwise sleep for the rest
+    while (1) {
+        // Interrupts stay off until we are asleep: a message queued after
+        // the caller's check shows up in the re-check or finds 'waiting'
+        // set, and the timeout cannot fire before we are blocked
+        u32 flags = irq_save();
+        proc->waiting = 1;
+        if (find_ready_queue(proc)) {
+            irq_restore(flags);
+            break;
+        }
+        if (timeout_ms != IPC_WAIT_FOREVER) {
+            u64 now = ktime_ns();
+            if (now >= deadline) {
+                irq_restore(flags);
+                break;
+            }
+            u32 left_ms = (u32)div_u64(deadline - now + NSEC_PER_MSEC - 1, NSEC_PER_MSEC, 0);
+            timer_add(&proc->timeout, timer_ms_to_ticks(left_ms), receive_timeout, proc);
+        }
+        block_process(pid);
+        wait_until_unblocked();
+        irq_restore(flags);
+        
+        proc = find_ipc_process(pid);
+        if (!proc || timeout_ms == IPC_WAIT_FOREVER || find_ready_queue(proc)) {
+            break;
+        }
+    }
+    
+    process_t *task = get_process(pid);
+    if (task) {
+        task->stats.ipc_wait_ns += ktime_ns() - wait_start;
+    }
+    
+    if (proc) {
+        proc->waiting = 0;
+        timer_cancel(&proc->timeout);
+    }
+    return proc;
+}
+
+// Double the buffer table (starts at IPC_BUFFERS_INITIAL slots)
+static int grow_ipc_buffers(void) {
+    u32 capacity = ipc_buffer_capacity ? ipc_buffer_capacity * 2 : IPC_BUFFERS_INITIAL;
+    if (capacity > IPC_BUFFERS_LIMIT) {
+        return 0;
+    }
+    
+    ipc_buffer_t *table = (ipc_buffer_t*)kmalloc(capacity * sizeof(ipc_buffer_t), 0, 0);
+    if (!table) {
+        return 0;
+    }
+    memset(table, 0, capacity * sizeof(ipc_buffer_t));
+    if (ipc_buffers) {
+        memory_copy((u8*)ipc_buffers, (u8*)table, ipc_buffer_capacity * sizeof(ipc_buffer_t));
+        kfree((u32)ipc_buffers);
+    }
+    
+    u32 first = ipc_buffer_capacity ? ipc_buffer_capacity : 1;
+    for (u32 i = capacity; i > first; i--) {
+        table[i - 1].next_free = ipc_buffer_free_head;
+        ipc_buffer_free_head = i - 1;
+    }
+    ipc_buffers = table;
+    ipc_buffer_capacity = capacity;
+    return 1;
+}
+
+static ipc_buffer_t* get_buffer(u32 handle) {
+    if (handle == 0 || handle >= ipc_buffer_capacity || ipc_buffers[handle].pages == 0) {
+        return 0;
+    }
+    return &ipc_buffers[handle];
+}
+
+// Hand the buffer to 'pid'. Kernel processes reach it through the
+// identity map, user processes get the frames mapped into their IPC window
+static int map_buffer(ipc_buffer_t *buf, u32 pid) {
+    process_t *proc = get_process(pid);
+    if (!proc || !proc->page_directory) {
+        return 0;
+    }
+    
+    if (proc->page_directory == kernel_directory) {
+        buf->owner_pid = pid;
+        buf->addr = buf->phys;
+        buf->region_id = -1;
+        return 1;
+    }
+    
+    u32 size = buf->pages * PAGE_SIZE;
+    u32 addr = find_free_range(pid, USER_IPC_BASE, USER_IPC_END, size);
+    if (!addr) {
+        return 0;
+    }
+    int region_id = allocate_memory_region(addr, size, PERMISSION_READ | PERMISSION_WRITE,
+                                           pid, MEMORY_TYPE_IPC);
+    if (region_id == -1) {
+        return 0;
+    }
+    
+    for (u32 i = 0; i < buf->pages; i++) {
+        if (!paging_map_page(proc->page_directory, addr + i * PAGE_SIZE,
+                             buf->phys + i * PAGE_SIZE, PAGE_USER | PAGE_WRITE)) {
+            // Unmap first so freeing the region leaves the frames alone
+            for (u32 j = 0; j < i; j++) {
+                paging_unmap_page(proc->page_directory, addr + j * PAGE_SIZE);
+            }
+            free_memory_region(region_id);
+            return 0;
+        }
+    }
+    
+    buf->owner_pid = pid;
+    buf->addr = addr;
+    buf->region_id = region_id;
+    return 1;
+}
+
+// Take the buffer out of its owner's address space, keeping the frames
+static void unmap_buffer(ipc_buffer_t *buf) {
+    if (buf->region_id != -1) {
+        process_t *proc = get_process(buf->owner_pid);
+        if (proc && proc->page_directory) {
+            for (u32 i = 0; i < buf->pages; i++) {
+                paging_unmap_page(proc->page_directory, buf->addr + i * PAGE_SIZE);
+            }
+        }
+        free_memory_region(buf->region_id);
+    }
+    buf->addr = 0;
+    buf->region_id = -1;
+}
+
+static void release_buffer(u32 handle) {
+    ipc_buffer_t *buf = &ipc_buffers[handle];
+    unmap_buffer(buf);
+    pmm_free_frames(buf->phys, buf->pages);
+    buf->phys = 0;
+    buf->pages = 0;
+    buf->owner_pid = 0;
+    buf->next_free = ipc_buffer_free_head;
+    ipc_buffer_free_head = handle;
+}
+
+// Allocate a zero-copy buffer of at least 'size' bytes for 'pid'.
+// Returns its handle, 0 on failure
+u32 ipc_buffer_alloc(u32 pid, u32 size) {
+    u32 pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0 || pages > IPC_MAX_BUFFER_PAGES) {
+        klog_warn("IPC: Invalid buffer size %u", size);
+        return 0;
+    }
+    
+    u32 phys = pmm_alloc_frames(pages);
+    if (!phys) {
+        klog_warn("IPC: Out of memory for a %u page buffer", pages);
+        return 0;
+    }
+    // The frames may hold another process' old data
+    memset((void*)phys, 0, pages * PAGE_SIZE);
+    
+    u32 flags = irq_save();
+    if (!ipc_buffer_free_head && !grow_ipc_buffers()) {
+        irq_restore(flags);
+        pmm_free_frames(phys, pages);
+        klog_warn("IPC: Buffer table full");
+        return 0;
+    }
+    
+    u32 handle = ipc_buffer_free_head;
+    ipc_buffer_t *buf = &ipc_buffers[handle];
+    buf->phys = phys;
+    buf->pages = pages;
+    if (!map_buffer(buf, pid)) {
+        buf->phys = 0;
+        buf->pages = 0;
+        irq_restore(flags);
+        pmm_free_frames(phys, pages);
+        klog_warn("IPC: Could not map buffer for PID %u", pid);
+        return 0;
+    }
+    ipc_buffer_free_head = buf->next_free;
+    irq_restore(flags);
+    return handle;
+}
+
+// Owner's address of a buffer, 0 if 'pid' does not hold it right now
+u32 ipc_buffer_address(u32 pid, u32 handle) {
+    u32 flags = irq_save();
+    ipc_buffer_t *buf = get_buffer(handle);
+    u32 addr = buf && buf->owner_pid == pid ? buf->addr : 0;
+    irq_restore(flags);
+    return addr;
+}
+
+// Free a buffer the caller holds (not one still in flight)
+u32 ipc_buffer_free(u32 pid, u32 handle) {
+    u32 flags = irq_save();
+    ipc_buffer_t *buf = get_buffer(handle);
+    if (!buf || buf->owner_pid != pid || !buf->addr) {
+        irq_restore(flags);
+        return 0;
+    }
+    release_buffer(handle);
+    irq_restore(flags);
+    return 1;
+}
+
+static u32 create_queue(u32 pid, u32 max_messages) {
     ipc_process_t *ipc_proc = find_ipc_process(pid);
     
     if (!ipc_proc) {
         ipc_proc = create_ipc_process(pid);
         if (!ipc_proc) {
-            kprint("IPC: Failed to create process entry for PID ");
-            char pid_str[10];
-            int_to_ascii(pid, pid_str);
-            kprint(pid_str);
-            kprint("\n");
+            klog_warn("IPC: Failed to create process entry for PID %u", pid);
             return 0;
         }
     }
     
     if (ipc_proc->queue_count >= IPC_MAX_QUEUES_PER_PROCESS) {
-        kprint("IPC: Process ");
-        char pid_str[10];
-        int_to_ascii(pid, pid_str);
-        kprint(pid_str);
-        kprint(" has reached maximum queue limit\n");
+        klog_warn("IPC: Process %u has reached maximum queue limit", pid);
         return 0;
     }
     
+    if (max_messages == 0 || max_messages > IPC_MAX_MESSAGES_PER_QUEUE) {
+        max_messages = IPC_MAX_MESSAGES_PER_QUEUE;
+    }
+    
     // Find an empty queue slot
     for (int i = 0; i < IPC_MAX_QUEUES_PER_PROCESS; i++) {
-        if (ipc_proc->queues[i].queue_id == 0) {
-            ipc_proc->queues[i].queue_id = next_queue_id++;
-            ipc_proc->queues[i].owner_pid = pid;
-            ipc_proc->queues[i].max_messages = max_messages;
-            ipc_proc->queues[i].current_count = 0;
-            ipc_proc->queues[i].head = 0;
-            ipc_proc->queues[i].tail = 0;
-            ipc_proc->queues[i].status = IPC_QUEUE_EMPTY;
-            ipc_proc->queues[i].total_messages_processed = 0;
-            ipc_proc->queues[i].total_messages_dropped = 0;
+        if (!ipc_proc->queues[i]) {
+            ipc_queue_t *queue = (ipc_queue_t*)kmalloc(sizeof(ipc_queue_t), 0, 0);
+            if (!queue) {
+                klog_warn("IPC: Out of memory for queue");
+                return 0;
+            }
+            queue->queue_id = next_queue_id++;
+            queue->owner_pid = pid;
+            queue->slot = i;
+            reset_queue(queue, max_messages);
+            if (!hash_put(&queue_table, queue->queue_id, queue)) {
+                kfree((u32)queue);
+                klog_warn("IPC: Out of memory for queue");
+                return 0;
+            }
+            ipc_proc->queues[i] = queue;
             ipc_proc->queue_count++;
             total_queues_created++;
             
-            kprint("IPC: Created queue ");
-            char queue_str[10];
-            int_to_ascii(ipc_proc->queues[i].queue_id, queue_str);
-            kprint(queue_str);
-            kprint(" for PID ");
-            char pid_str[10];
-            int_to_ascii(pid, pid_str);
-            kprint(pid_str);
-            kprint("\n");
+            klog_debug("IPC: Created queue %u for PID %u", queue->queue_id, pid);
             
-            return ipc_proc->queues[i].queue_id;
+            return queue->queue_id;
         }
     }
     
     return 0;
 }
 
-// Delete an IPC queue
-u32 ipc_delete_queue(u32 queue_id) {
-    for (int i = 0; i < 32; i++) {
-        for (int j = 0; j < IPC_MAX_QUEUES_PER_PROCESS; j++) {
-            if (ipc_processes[i].queues[j].queue_id == queue_id) {
-                ipc_processes[i].queues[j].queue_id = 0;
-                ipc_processes[i].queues[j].owner_pid = 0;
-                ipc_processes[i].queues[j].max_messages = 0;
-                ipc_processes[i].queues[j].current_count = 0;
-                ipc_processes[i].queues[j].head = 0;
-                ipc_processes[i].queues[j].tail = 0;
-                ipc_processes[i].queues[j].status = IPC_QUEUE_EMPTY;
-                ipc_processes[i].queues[j].total_messages_processed = 0;
-                ipc_processes[i].queues[j].total_messages_dropped = 0;
-                ipc_processes[i].queue_count--;
-                
-                kprint("IPC: Deleted queue ");
-                char queue_str[10];
-                int_to_ascii(queue_id, queue_str);
-                kprint(queue_str);
-                kprint("\n");
-                
-                return 1;
-            }
+// Create an IPC queue for a process
+u32 ipc_create_queue(u32 pid, u32 max_messages) {
+    u32 flags = irq_save();
+    u32 queue_id = create_queue(pid, max_messages);
+    irq_restore(flags);
+    return queue_id;
+}
+
+static u32 delete_queue(u32 queue_id) {
+    ipc_queue_t *queue = (ipc_queue_t*)hash_get(&queue_table, queue_id);
+    if (!queue) {
+        return 0;
+    }
+    
+    // Buffers of undelivered messages go down with the queue
+    for (u32 k = 0; k < queue->max_messages; k++) {
+        ipc_message_t *msg = &queue->messages[k];
+        if (!(queue->free_slots & (1u << k)) && get_buffer(msg->buffer)) {
+            release_buffer(msg->buffer);
         }
     }
-    return 0;
+    
+    ipc_process_t *owner = find_ipc_process(queue->owner_pid);
+    if (owner) {
+        owner->pending_messages -= queue->current_count;
+        owner->queues[queue->slot] = 0;
+        owner->queue_count--;
+    }
+    hash_remove(&queue_table, queue_id);
+    kfree((u32)queue);
+    
+    klog_debug("IPC: Deleted queue %u", queue_id);
+    
+    return 1;
+}
+
+// Delete an IPC queue
+u32 ipc_delete_queue(u32 queue_id) {
+    u32 flags = irq_save();
+    u32 deleted = delete_queue(queue_id);
+    irq_restore(flags);
+    return deleted;
 }
 
 // Send a message to a process (basic version)
@@ -174,87 +598,68 @@ u32 ipc_send_message(u32 sender_pid, u32 receiver_pid,
     return ipc_send_with_priority(sender_pid, receiver_pid, message_type, data, data_size, IPC_PRIORITY_NORMAL);
 }
 
-// Enhanced send message with priority
-u32 ipc_send_with_priority(u32 sender_pid, u32 receiver_pid, 
-                           u32 message_type, void *data, u32 data_size, u32 priority) {
+// Build a message in the receiver's queue (ordered by priority) and
+// wake the receiver. The header, the inline payload or the buffer handoff
+// are all complete before the message is linked, so a receiver never
+// sees half of one. Returns the message id, 0 when it cannot be queued
+static u32 enqueue_message(u32 sender_pid, u32 receiver_pid, u32 message_type,
+                           const void *data, u32 data_size, ipc_buffer_t *buf,
+                           u32 priority) {
     ipc_process_t *receiver = find_ipc_process(receiver_pid);
     
     if (!receiver) {
-        kprint("IPC: Receiver PID ");
-        char pid_str[10];
-        int_to_ascii(receiver_pid, pid_str);
-        kprint(pid_str);
-        kprint(" not found\n");
+        klog_debug("IPC: Receiver PID %u not found", receiver_pid);
         return 0;
     }
     
     // Find a queue for the receiver
     ipc_queue_t *queue = 0;
     for (int i = 0; i < IPC_MAX_QUEUES_PER_PROCESS; i++) {
-        if (receiver->queues[i].queue_id != 0) {
-            queue = &receiver->queues[i];
+        if (receiver->queues[i]) {
+            queue = receiver->queues[i];
             break;
         }
     }
     
     if (!queue) {
-        kprint("IPC: No queue found for receiver PID ");
-        char pid_str[10];
-        int_to_ascii(receiver_pid, pid_str);
-        kprint(pid_str);
-        kprint("\n");
+        klog_debug("IPC: No queue found for receiver PID %u", receiver_pid);
         return 0;
     }
     
     if (queue->current_count >= queue->max_messages) {
         queue->total_messages_dropped++;
         total_messages_dropped++;
-        kprint("IPC: Queue full for receiver PID ");
-        char pid_str[10];
-        int_to_ascii(receiver_pid, pid_str);
-        kprint(pid_str);
-        kprint(", message dropped\n");
+        klog_warn("IPC: Queue full for receiver PID %u, message dropped", receiver_pid);
         return 0;
     }
     
-    // Add message to queue with priority ordering
-    u32 insert_index = queue->tail;
-    
-    // Find the correct position based on priority
-    for (u32 i = 0; i < queue->current_count; i++) {
-        u32 idx = (queue->head + i) % queue->max_messages;
-        if (queue->messages[idx].priority < priority) {
-            // Move existing messages to make room
-            for (u32 j = queue->current_count; j > i; j--) {
-                u32 src_idx = (queue->head + j - 1) % queue->max_messages;
-                u32 dst_idx = (queue->head + j) % queue->max_messages;
-                memory_copy((u8*)&queue->messages[src_idx], (u8*)&queue->messages[dst_idx], sizeof(ipc_message_t));
-            }
-            insert_index = (queue->head + i) % queue->max_messages;
-            break;
-        }
-    }
-    
-    // Create the message
-    ipc_message_t *msg = &queue->messages[insert_index];
-    msg->message_id = next_message_id++;
+    u32 level = priority_level(priority);
+    ipc_message_t *msg = queue_claim(queue);
+    u32 message_id = next_message_id++;
+    msg->message_id = message_id;
     msg->sender_pid = sender_pid;
     msg->receiver_pid = receiver_pid;
     msg->message_type = message_type;
     msg->data_size = data_size;
     msg->status = IPC_MSG_STATUS_UNREAD;
-    msg->priority = priority;
-    msg->timestamp = system_start_time; // Will be enhanced with real timer
-    
-    // Copy data if provided
-    if (data && data_size > 0 && data_size <= IPC_MAX_MESSAGE_SIZE) {
+    msg->priority = level + IPC_PRIORITY_LOW;
+    msg->timestamp = ktime_ns();
+    msg->buffer = 0;
+    msg->buffer_addr = 0;
+    
+    if (buf) {
+        // The pages leave the sender now and reach the receiver on receive
+        unmap_buffer(buf);
+        buf->owner_pid = receiver_pid;
+        msg->buffer = buf - ipc_buffers;
+    } else if (data && data_size > 0) {
         memory_copy((u8*)data, (u8*)msg->data, data_size);
     }
     
+    // Append to the ring of its priority level
+    queue_push(queue, level, msg);
+    
     // Update queue
-    queue->tail = (queue->tail + 1) % queue->max_messages;
-    queue->current_count++;
-    queue->status = IPC_QUEUE_HAS_MESSAGES;
     queue->total_messages_processed++;
     receiver->pending_messages++;
     
@@ -265,22 +670,54 @@ u32 ipc_send_with_priority(u32 sender_pid, u32 receiver_pid,
     }
     
     total_messages_sent++;
+    wake_receiver(receiver);
     
-    kprint("IPC: Priority message sent from PID ");
-    char sender_str[10];
-    int_to_ascii(sender_pid, sender_str);
-    kprint(sender_str);
-    kprint(" to PID ");
-    char receiver_str[10];
-    int_to_ascii(receiver_pid, receiver_str);
-    kprint(receiver_str);
-    kprint(" (Priority: ");
-    char priority_str[10];
-    int_to_ascii(priority, priority_str);
-    kprint(priority_str);
-    kprint(")\n");
+    return message_id;
+}
+
+// Enhanced send message with priority
+u32 ipc_send_with_priority(u32 sender_pid, u32 receiver_pid, 
+                           u32 message_type, void *data, u32 data_size, u32 priority) {
+    if (data_size > IPC_MAX_MESSAGE_SIZE) {
+        klog_warn("IPC: %u byte message from PID %u exceeds %u bytes",
+                  data_size, sender_pid, IPC_MAX_MESSAGE_SIZE);
+        return 0;
+    }
     
-    return msg->message_id;
+    u32 flags = irq_save();
+    u32 message_id = enqueue_message(sender_pid, receiver_pid, message_type,
+                                     data, data_size, 0, priority);
+    irq_restore(flags);
+    if (!message_id) {
+        return 0;
+    }
+    
+    klog_debug("IPC: Message sent from PID %u to PID %u (Priority: %u)",
+               sender_pid, receiver_pid, priority_level(priority) + IPC_PRIORITY_LOW);
+    
+    return message_id;
+}
+
+// Send a zero-copy buffer. Only the handle is queued: the pages leave the
+// sender's address space now and show up in the receiver's when it picks
+// the message up, whatever their size
+u32 ipc_send_buffer(u32 sender_pid, u32 receiver_pid, u32 message_type,
+                    u32 handle, u32 size, u32 priority) {
+    u32 flags = irq_save();
+    ipc_buffer_t *buf = get_buffer(handle);
+    if (!buf || buf->owner_pid != sender_pid || !buf->addr) {
+        irq_restore(flags);
+        klog_debug("IPC: PID %u does not hold buffer %u", sender_pid, handle);
+        return 0;
+    }
+    if (size > buf->pages * PAGE_SIZE) {
+        size = buf->pages * PAGE_SIZE;
+    }
+    
+    u32 message_id = enqueue_message(sender_pid, receiver_pid, message_type,
+                                     0, size, buf, priority);
+    irq_restore(flags);
+    return message_id;
 }
 
 // Receive a message for a process (basic version)
@@ -288,94 +725,93 @@ u32 ipc_receive_message(u32 receiver_pid, ipc_message_t *message) {
     return ipc_receive_with_timeout(receiver_pid, message, 0); // No timeout
 }
 
-// Enhanced receive message with timeout
-u32 ipc_receive_with_timeout(u32 receiver_pid, ipc_message_t *message, u32 timeout_ms) {
+static u32 receive_message(u32 receiver_pid, ipc_message_t *message, u32 timeout_ms) {
     ipc_process_t *receiver = find_ipc_process(receiver_pid);
     
     if (!receiver) {
-        kprint("IPC: Receiver PID ");
-        char pid_str[10];
-        int_to_ascii(receiver_pid, pid_str);
-        kprint(pid_str);
-        kprint(" not found\n");
+        klog_debug("IPC: Receiver PID %u not found", receiver_pid);
         return 0;
     }
     
-    // Find a queue with messages
-    ipc_queue_t *queue = 0;
-    for (int i = 0; i < IPC_MAX_QUEUES_PER_PROCESS; i++) {
-        if (receiver->queues[i].queue_id != 0 && 
-            receiver->queues[i].current_count > 0) {
-            queue = &receiver->queues[i];
-            break;
+    // Find a queue with messages. Only the running process can sleep on
+    // its own queues; receiving on behalf of another one always polls
+    ipc_queue_t *queue = find_ready_queue(receiver);
+    if (!queue && timeout_ms > 0 && (int)receiver_pid == get_current_pid()) {
+        receiver = wait_for_message(receiver, timeout_ms);
+        if (!receiver) {
+            return 0;
         }
+        queue = find_ready_queue(receiver);
     }
     
     if (!queue) {
         if (timeout_ms > 0) {
-            kprint("IPC: No messages for PID ");
-            char pid_str[10];
-            int_to_ascii(receiver_pid, pid_str);
-            kprint(pid_str);
-            kprint(" (timeout)\n");
+            klog_debug("IPC: No messages for PID %u (timeout)", receiver_pid);
             message->status = IPC_MSG_STATUS_TIMEOUT;
         } else {
-            kprint("IPC: No messages for PID ");
-            char pid_str[10];
-            int_to_ascii(receiver_pid, pid_str);
-            kprint(pid_str);
-            kprint("\n");
+            klog_debug("IPC: No messages for PID %u", receiver_pid);
         }
         return 0;
     }
     
-    // Get highest priority message
-    u32 highest_priority = 0;
-    u32 best_index = queue->head;
+    // Oldest message of the highest priority level
+    u32 slot = queue_pop(queue);
     
-    for (u32 i = 0; i < queue->current_count; i++) {
-        u32 idx = (queue->head + i) % queue->max_messages;
-        if (queue->messages[idx].priority > highest_priority) {
-            highest_priority = queue->messages[idx].priority;
-            best_index = idx;
-        }
+    // Copy the header and only as much inline payload as was sent
+    ipc_message_t *msg = &queue->messages[slot];
+    u32 payload = 0;
+    if (!msg->buffer) {
+        payload = msg->data_size < IPC_MAX_MESSAGE_SIZE ? msg->data_size : IPC_MAX_MESSAGE_SIZE;
     }
-    
-    // Copy message
-    memory_copy((u8*)&queue->messages[best_index], (u8*)message, sizeof(ipc_message_t));
+    memory_copy((u8*)msg, (u8*)message, IPC_MESSAGE_HEADER_SIZE + payload);
     message->status = IPC_MSG_STATUS_READ;
     
-    // Remove message from queue
-    queue->messages[best_index].status = IPC_MSG_STATUS_READ;
-    queue->current_count--;
+    // Zero-copy buffers are mapped in for the receiver; if that fails the
+    // payload is lost and the message arrives empty
+    if (message->buffer) {
+        ipc_buffer_t *buf = get_buffer(message->buffer);
+        if (buf && map_buffer(buf, receiver_pid)) {
+            message->buffer_addr = buf->addr;
+        } else {
+            if (buf) release_buffer(message->buffer);
+            message->buffer = 0;
+            message->data_size = 0;
+            total_messages_dropped++;
+        }
+    }
+    
+    // The slot can be reused now that the message is copied out
+    msg->status = IPC_MSG_STATUS_READ;
+    queue_release(queue, slot);
     receiver->pending_messages--;
     receiver->total_messages_received++;
     total_messages_received++;
     
-    if (queue->current_count == 0) {
-        queue->status = IPC_QUEUE_EMPTY;
-    }
-    
-    kprint("IPC: Priority message received by PID ");
-    char pid_str[10];
-    int_to_ascii(receiver_pid, pid_str);
-    kprint(pid_str);
-    kprint(" (Priority: ");
-    char priority_str[10];
-    int_to_ascii(message->priority, priority_str);
-    kprint(priority_str);
-    kprint(")\n");
+    klog_debug("IPC: Message received by PID %u (Priority: %u)",
+               receiver_pid, message->priority);
     
     return message->message_id;
 }
 
+// Enhanced receive message with timeout. Sleeping in wait_for_message()
+// lets other processes run; the tables are consistent whenever it blocks
+u32 ipc_receive_with_timeout(u32 receiver_pid, ipc_message_t *message, u32 timeout_ms) {
+    u32 flags = irq_save();
+    u32 message_id = receive_message(receiver_pid, message, timeout_ms);
+    irq_restore(flags);
+    return message_id;
+}
+
 // Broadcast message to all processes
 u32 ipc_broadcast_message(u32 sender_pid, u32 message_type, void *data, u32 data_size) {
     u32 broadcast_count = 0;
     
-    for (int i = 0; i < 32; i++) {
-        if (ipc_processes[i].pid != 0 && ipc_processes[i].pid != sender_pid) {
-            if (ipc_send_with_priority(sender_pid, ipc_processes[i].pid,
+    // The process table must not grow under the walk
+    u32 flags = irq_save();
+    for (u32 i = 0; i < process_table.capacity; i++) {
+        ipc_process_t *proc = (ipc_process_t*)process_table.entries[i].value;
+        if (proc && proc->pid != sender_pid) {
+            if (ipc_send_with_priority(sender_pid, proc->pid,
                                      message_type, data, data_size,
                                      IPC_PRIORITY_NORMAL)) {
                 broadcast_count++;
@@ -384,11 +820,8 @@ u32 ipc_broadcast_message(u32 sender_pid, u32 message_type, void *data, u32 data
     }
     
     total_broadcasts++;
-    kprint("IPC: Broadcast sent to ");
-    char count_str[10];
-    int_to_ascii(broadcast_count, count_str);
-    kprint(count_str);
-    kprint(" processes\n");
+    irq_restore(flags);
+    klog_debug("IPC: Broadcast sent to %u processes", broadcast_count);
     
     return broadcast_count;
 }
@@ -398,15 +831,7 @@ void ipc_set_process_priority(u32 pid, u32 priority) {
     ipc_process_t *proc = find_ipc_process(pid);
     if (proc) {
         proc->priority = priority;
-        kprint("IPC: Set priority ");
-        char priority_str[10];
-        int_to_ascii(priority, priority_str);
-        kprint(priority_str);
-        kprint(" for PID ");
-        char pid_str[10];
-        int_to_ascii(pid, pid_str);
-        kprint(pid_str);
-        kprint("\n");
+        klog_debug("IPC: Set priority %u for PID %u", priority, pid);
     }
 }
 
@@ -421,36 +846,40 @@ u32 ipc_get_system_stats(ipc_system_stats_t *stats) {
     stats->total_broadcasts = total_broadcasts;
     stats->average_message_size = total_messages_sent > 0 ? 128 : 0; // Placeholder
     stats->peak_queue_depth = 0; // Would need to track this
-    stats->system_uptime = system_start_time;
+    stats->system_uptime = ktime_ns() - system_start_time;
     
     return 1;
 }
 
 // Clean up IPC data for a process
 void ipc_cleanup_process(u32 pid) {
+    u32 flags = irq_save();
+    
+    // Buffers it holds or that are on their way to it
+    for (u32 h = 1; h < ipc_buffer_capacity; h++) {
+        if (ipc_buffers[h].pages && ipc_buffers[h].owner_pid == pid) {
+            release_buffer(h);
+        }
+    }
+    
     ipc_process_t *proc = find_ipc_process(pid);
     if (proc) {
+        wake_receiver(proc);
+        
         // Delete all queues for this process
         for (int i = 0; i < IPC_MAX_QUEUES_PER_PROCESS; i++) {
-            if (proc->queues[i].queue_id != 0) {
-                ipc_delete_queue(proc->queues[i].queue_id);
+            if (proc->queues[i]) {
+                delete_queue(proc->queues[i]->queue_id);
             }
         }
         
-        // Clear process entry
-        proc->pid = 0;
-        proc->queue_count = 0;
-        proc->pending_messages = 0;
-        proc->total_messages_sent = 0;
-        proc->total_messages_received = 0;
-        proc->priority = IPC_PRIORITY_NORMAL;
+        // Drop the process entry
+        hash_remove(&process_table, pid);
+        kfree((u32)proc);
         
-        kprint("IPC: Cleaned up process ");
-        char pid_str[10];
-        int_to_ascii(pid, pid_str);
-        kprint(pid_str);
-        kprint("\n");
+        klog_debug("IPC: Cleaned up process %u", pid);
     }
+    irq_restore(flags);
 }
 
 // System call wrappers
@@ -462,7 +891,7 @@ u32 sys_ipc_send(u32 receiver_pid, u32 message_type,
 
 u32 sys_ipc_receive(ipc_message_t *message) {
     u32 current_pid = get_current_pid();
-    return ipc_receive_message(current_pid, message);
+    return ipc_receive_with_timeout(current_pid, message, IPC_WAIT_FOREVER);
 }
 
 u32 sys_ipc_create_queue(u32 max_messages) {
@@ -494,6 +923,25 @@ u32 sys_ipc_get_stats(ipc_system_stats_t *stats) {
     return ipc_get_system_stats(stats);
 }
 
+u32 sys_ipc_buffer_alloc(u32 size, u32 *addr) {
+    u32 current_pid = get_current_pid();
+    u32 handle = ipc_buffer_alloc(current_pid, size);
+    if (handle && addr) {
+        *addr = ipc_buffer_address(current_pid, handle);
+    }
+    return handle;
+}
+
+u32 sys_ipc_send_buffer(u32 receiver_pid, u32 message_type, u32 handle, u32 size, u32 priority) {
+    u32 current_pid = get_current_pid();
+    return ipc_send_buffer(current_pid, receiver_pid, message_type, handle, size, priority);
+}
+
+u32 sys_ipc_buffer_free(u32 handle) {
+    u32 current_pid = get_current_pid();
+    return ipc_buffer_free(current_pid, handle);
+}
+
 // Print enhanced IPC statistics
 void ipc_print_system_stats(void) {
     kprint("=== Enhanced IPC System Statistics ===\n");
@@ -528,26 +976,29 @@ void ipc_print_system_stats(void) {
     kprint("\n");
     
     kprint("Active processes:\n");
-    for (int i = 0; i < 32; i++) {
-        if (ipc_processes[i].pid != 0) {
+    u32 flags = irq_save();
+    for (u32 i = 0; i < process_table.capacity; i++) {
+        ipc_process_t *proc = (ipc_process_t*)process_table.entries[i].value;
+        if (proc) {
             kprint("  PID ");
             char pid_str[10];
-            int_to_ascii(ipc_processes[i].pid, pid_str);
+            int_to_ascii(proc->pid, pid_str);
             kprint(pid_str);
             kprint(": ");
             char queue_str[10];
-            int_to_ascii(ipc_processes[i].queue_count, queue_str);
+            int_to_ascii(proc->queue_count, queue_str);
             kprint(queue_str);
             kprint(" queues, ");
             char pending_str[10];
-            int_to_ascii(ipc_processes[i].pending_messages, pending_str);
+            int_to_ascii(proc->pending_messages, pending_str);
             kprint(pending_str);
             kprint(" pending messages, Priority: ");
             char priority_str[10];
-            int_to_ascii(ipc_processes[i].priority, priority_str);
+            int_to_ascii(proc->priority, priority_str);
             kprint(priority_str);
             kprint("\n");
         }
     }
+    irq_restore(flags);
     kprint("=====================================\n");
 } 
\ No newline at end of file
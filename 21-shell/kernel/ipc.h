@@ -2,6 +2,13 @@
 #define IPC_H
 
 #include "../cpu/types.h"
+#include "../cpu/timer.h"
+
+// Constants
+#define IPC_MAX_QUEUES_PER_PROCESS 4
+#define IPC_MAX_MESSAGE_SIZE 256
+#define IPC_MAX_MESSAGES_PER_QUEUE 16
+#define IPC_PRIORITY_LEVELS 4     // IPC_PRIORITY_LOW .. IPC_PRIORITY_URGENT
 
 // IPC message structure
 typedef struct {
@@ -13,24 +20,33 @@ typedef struct {
     u32 status;
     u32 priority;        // NEW: Priority levels
     u64 timestamp;       // NEW: Timestamp for ordering
+    u32 buffer;          // Zero-copy buffer handle, 0 when the payload is in data[]
+    u32 buffer_addr;     // Where the receiver finds that buffer
     u8 data[256]; // Maximum message data size
 } ipc_message_t;
 
-// IPC queue structure
+// IPC queue structure. A message stays in the slot it was written to;
+// every priority level keeps a FIFO ring of slot numbers, so send and
+// receive are O(1) and never move payloads
 typedef struct {
     u32 queue_id;
     u32 owner_pid;
     u32 max_messages;
     u32 current_count;
-    u32 head;
-    u32 tail;
     u32 status;
     u32 total_messages_processed;  // NEW: Statistics
     u32 total_messages_dropped;    // NEW: Statistics
-    ipc_message_t messages[16]; // Maximum 16 messages per queue
+    u32 free_slots;                // Bit per unused entry of messages[]
+    u32 ready_levels;              // Bit per priority level holding messages
+    u32 slot;                      // Index in the owner's queues[]
+    u8 head[IPC_PRIORITY_LEVELS];  // Oldest entry of each level's ring
+    u8 count[IPC_PRIORITY_LEVELS];
+    u8 ring[IPC_PRIORITY_LEVELS][IPC_MAX_MESSAGES_PER_QUEUE];
+    ipc_message_t messages[IPC_MAX_MESSAGES_PER_QUEUE];
 } ipc_queue_t;
 
-// IPC process structure
+// IPC process structure. Entries and their queues are allocated on
+// first use and found through hash tables keyed by PID and queue id
 typedef struct {
     u32 pid;
     u32 queue_count;
@@ -38,13 +54,25 @@ typedef struct {
     u32 total_messages_sent;
     u32 total_messages_received;
     u32 priority;        // NEW: Process priority
-    ipc_queue_t queues[4]; // Maximum 4 queues per process
+    u32 waiting;         // Blocked in receive until a message or the timeout
+    ktimer_t timeout;    // Receive timeout
+    ipc_queue_t *queues[IPC_MAX_QUEUES_PER_PROCESS];
 } ipc_process_t;
 
-// Constants
-#define IPC_MAX_QUEUES_PER_PROCESS 4
-#define IPC_MAX_MESSAGE_SIZE 256
-#define IPC_MAX_MESSAGES_PER_QUEUE 16
+
+// Zero-copy buffers are runs of physically contiguous pages. Sending one
+// moves it to the receiver's address space instead of copying it, so the
+// cost does not depend on the size (up to IPC_MAX_BUFFER_PAGES pages)
+#define IPC_MAX_BUFFER_PAGES 256
+#define IPC_BUFFERS_INITIAL  16
+#define IPC_BUFFERS_LIMIT    4096
+
+// Initial size of the PID and queue id hash tables (they double as needed)
+#define IPC_HASH_INITIAL 32
+
+// Receive timeouts: 0 polls, IPC_WAIT_FOREVER blocks until a message
+// arrives, anything else blocks at most that many milliseconds
+#define IPC_WAIT_FOREVER 0xFFFFFFFF
 
 // Message status
 #define IPC_MSG_STATUS_UNREAD 0
@@ -79,6 +107,9 @@ typedef struct {
 #define SYS_IPC_RECEIVE_TIMEOUT 25  // NEW: Timeout receive
 #define SYS_IPC_BROADCAST 26        // NEW: Broadcast
 #define SYS_IPC_GET_STATS 27        // NEW: Statistics
+#define SYS_IPC_BUFFER_ALLOC 28
+#define SYS_IPC_SEND_BUFFER 29
+#define SYS_IPC_BUFFER_FREE 30
 
 // IPC System Statistics
 typedef struct {
@@ -108,6 +139,14 @@ u32 ipc_broadcast_message(u32 sender_pid, u32 message_type, void *data, u32 data
 u32 ipc_get_system_stats(ipc_system_stats_t *stats);
 void ipc_set_process_priority(u32 pid, u32 priority);
 
+// Zero-copy transfers. Buffers are named by handle; the owner sees the
+// pages at ipc_buffer_address() (identity mapped for kernel processes,
+// in the USER_IPC_BASE window for user processes)
+u32 ipc_buffer_alloc(u32 pid, u32 size);
+u32 ipc_buffer_address(u32 pid, u32 handle);
+u32 ipc_buffer_free(u32 pid, u32 handle);
+u32 ipc_send_buffer(u32 sender_pid, u32 receiver_pid, u32 message_type, u32 handle, u32 size, u32 priority);
+
 // System call wrappers
 u32 sys_ipc_send(u32 receiver_pid, u32 message_type, void *data, u32 data_size);
 u32 sys_ipc_receive(ipc_message_t *message);
@@ -119,5 +158,8 @@ u32 sys_ipc_send_priority(u32 receiver_pid, u32 message_type, void *data, u32 da
 u32 sys_ipc_receive_timeout(ipc_message_t *message, u32 timeout);
 u32 sys_ipc_broadcast(u32 message_type, void *data, u32 data_size);
 u32 sys_ipc_get_stats(ipc_system_stats_t *stats);
+u32 sys_ipc_buffer_alloc(u32 size, u32 *addr);
+u32 sys_ipc_send_buffer(u32 receiver_pid, u32 message_type, u32 handle, u32 size, u32 priority);
+u32 sys_ipc_buffer_free(u32 handle);
 
 #endif // IPC_H 
\ No newline at end of file
@@ -13,6 +13,14 @@
 #include "../drivers/print.h"
 #include "ipc.h"
 #include "../cpu/timer.h"
+#include "pmm.h"
+#include "../cpu/paging.h"
+#include "../cpu/fpu.h"
+#include "../cpu/clock.h"
+#include "../cpu/gdt.h"
+#include "multiboot2.h"
+#include "klog.h"
+#include "shell.h"
 
 #define NULL ((void*)0)
 #define UNUSED(x) (void)(x)
@@ -31,8 +39,22 @@ void main(void) {
     kprint("Hello from kernel!\n");
     kprint("Kernel loaded successfully!\n");
     
+    // Kernel log sinks (COM1 if there is one)
+    init_klog();
+    
+    // Physical memory first (from the multiboot2 map when we have one),
+    // the kernel heap is carved out of it
+    init_pmm(multiboot2_magic, multiboot2_info);
+    init_kernel_heap();
+    init_paging();
+    
+    // Our own GDT: the loader's has no user segments
+    gdt_init();
+    
     // Basic initialization only
     isr_install();
+    init_fpu();
+    init_clock();
     irq_install();
     
     // Initialize IPC system
@@ -41,9 +63,15 @@ void main(void) {
     // Initialize process manager
     init_process_manager();
     
+    // System call table
+    init_syscall_interface();
+    
+    // Commands run in the shell thread, fed by the keyboard ring
+    init_shell();
+    
     // Create some test processes to make commands show meaningful data
-    create_process(test_process_function, (void*)0x30000, PRIVILEGE_USER);
-    create_process(test_process_function, (void*)0x40000, PRIVILEGE_USER);
+    create_process(test_process_function, NULL, PRIVILEGE_USER);
+    create_process(test_process_function, NULL, PRIVILEGE_USER);
     
     // Allocate some memory to test memory statistics
     kmalloc(1024, 1, NULL);
@@ -72,50 +100,139 @@ void main(void) {
     kprint("Test memory allocations created!\n");
     kprint("Test IPC activity created!\n");
     kprint("System ready!\n> ");
+    
+    // Let the timer preempt: the test processes run from here on
+    start_scheduler();
+    
+    // The boot context is the idle task from here on. It writes out the
+    // kernel log between interrupts, so the code that logs never waits
+    // for the screen or the serial port
+    run_idle_task(klog_flush);
 }
 
 void user_input(char *input) {
+    // Pending log lines go before the command's output
+    klog_flush();
+    
     if (strcmp(input, "END") == 0) {
         kprint("Stopping the CPU. Bye!\n");
         asm volatile("hlt");
     } else if (strcmp(input, "MEMORY") == 0) {
-        u32 total, count, max;
-        get_memory_stats(&total, &count, &max);
+        memory_stats_t stats;
+        get_memory_stats(&stats);
+        char num_str[12];
         
         kprint("Memory Statistics:\n");
         kprint("Total allocated: ");
-        char total_str[10];
-        int_to_ascii(total, total_str);
-        kprint(total_str);
+        int_to_ascii(stats.total_allocated, num_str);
+        kprint(num_str);
         kprint(" bytes\n");
         
         kprint("Allocation count: ");
-        char count_str[10];
-        int_to_ascii(count, count_str);
-        kprint(count_str);
-        kprint("\n");
+        int_to_ascii(stats.allocation_count, num_str);
+        kprint(num_str);
+        kprint(" (freed: ");
+        int_to_ascii(stats.free_count, num_str);
+        kprint(num_str);
+        kprint(")\n");
         
         kprint("Max allocation: ");
-        char max_str[10];
-        int_to_ascii(max, max_str);
-        kprint(max_str);
+        int_to_ascii(stats.max_allocation, num_str);
+        kprint(num_str);
         kprint(" bytes\n");
         
+        kprint("Live: ");
+        int_to_ascii(stats.live_bytes, num_str);
+        kprint(num_str);
+        kprint(" of ");
+        int_to_ascii(stats.committed_bytes, num_str);
+        kprint(num_str);
+        kprint(" committed bytes (");
+        int_to_ascii(stats.fragmentation, num_str);
+        kprint(num_str);
+        kprint("% fragmentation)\n");
+        
+        kprint("Heap pages free: ");
+        int_to_ascii(stats.free_pages, num_str);
+        kprint(num_str);
+        kprint("/");
+        int_to_ascii(stats.total_pages, num_str);
+        kprint(num_str);
+        kprint(" (largest run: ");
+        int_to_ascii(stats.largest_free_run, num_str);
+        kprint(num_str);
+        kprint(")\n");
+        
+        pmm_stats_t pstats;
+        pmm_get_stats(&pstats);
+        kprint("Physical frames free: ");
+        int_to_ascii(pstats.free_frames, num_str);
+        kprint(num_str);
+        kprint("/");
+        int_to_ascii(pstats.usable_frames, num_str);
+        kprint(num_str);
+        kprint(" (");
+        int_to_ascii(pstats.free_frames * (PMM_FRAME_SIZE / 1024), num_str);
+        kprint(num_str);
+        kprint(" KB)\n");
+        
+        kprint("Size classes (live/capacity):\n");
+        for (int c = 0; c < KMALLOC_NUM_CLASSES; c++) {
+            if (stats.class_capacity[c] == 0) continue;
+            kprint("  ");
+            int_to_ascii(stats.class_size[c], num_str);
+            kprint(num_str);
+            kprint("B: ");
+            int_to_ascii(stats.class_live[c], num_str);
+            kprint(num_str);
+            kprint("/");
+            int_to_ascii(stats.class_capacity[c], num_str);
+            kprint(num_str);
+            kprint("\n");
+        }
+        
         kprint("> ");
     } else if (strcmp(input, "STATS") == 0) {
         ipc_print_system_stats();
+        
+        klog_stats_t log_stats;
+        klog_get_stats(&log_stats);
+        char num_str[12];
+        kprint("Kernel log: ");
+        int_to_ascii(log_stats.written, num_str);
+        kprint(num_str);
+        kprint(" written, ");
+        int_to_ascii(log_stats.dropped, num_str);
+        kprint(num_str);
+        kprint(" dropped, ");
+        int_to_ascii(log_stats.suppressed, num_str);
+        kprint(num_str);
+        kprint(" rate limited\n");
+        
+        kprint("Keyboard: ");
+        int_to_ascii(keyboard_dropped(), num_str);
+        kprint(num_str);
+        kprint(" scancodes dropped\n");
         kprint("> ");
     } else if (strcmp(input, "PROCESSES") == 0) {
         print_all_processes();
         kprint("> ");
+    } else if (strcmp(input, "TOP") == 0) {
+        print_process_top();
+        kprint("> ");
+    } else if (strcmp(input, "IRQSTATS") == 0) {
+        print_interrupt_stats();
+        kprint("> ");
     } else if (strcmp(input, "CLEAR") == 0) {
         clear_screen();
         kprint("> ");
     } else if (strcmp(input, "TIME") == 0) {
-        // Convert ticks to time (50 ticks per second)
-        u32 seconds = tick / 50;
+        // Uptime from the clocksource, to the millisecond
+        u32 millis = (u32)div_u64(ktime_ns(), NSEC_PER_MSEC, NULL);
+        u32 seconds = millis / 1000;
         u32 minutes = seconds / 60;
         u32 hours = minutes / 60;
+        millis = millis % 1000;
         seconds = seconds % 60;
         minutes = minutes % 60;
         
@@ -138,6 +255,13 @@ void user_input(char *input) {
         char seconds_str[10];
         int_to_ascii(seconds, seconds_str);
         kprint(seconds_str);
+        kprint(".");
+        
+        // Milliseconds, zero padded to three digits
+        char millis_str[4] = {
+            '0' + millis / 100, '0' + millis / 10 % 10, '0' + millis % 10, '\0'
+        };
+        kprint(millis_str);
         kprint("s (");
         
         char tick_str[10];
@@ -152,6 +276,8 @@ void user_input(char *input) {
         kprint("MEMORY    - Display memory statistics\n");
         kprint("STATS     - Display IPC system statistics\n");
         kprint("PROCESSES - Display all active processes\n");
+        kprint("TOP       - Show CPU usage per process, busiest first\n");
+        kprint("IRQSTATS  - Show interrupt counts and handler times\n");
         kprint("CLEAR     - Clear the screen\n");
         kprint("TIME      - Show system uptime\n");
         kprint("HELP      - Show this help message\n");
@@ -0,0 +1,223 @@
+#include "klog.h"
+#include "../drivers/screen.h"
+#include "../drivers/serial.h"
+#include "../cpu/timer.h"
+
+#define KLOG_RING_MASK (KLOG_RING_SIZE - 1)
+#define KLOG_SKIP      0xFF  // Padding record up to the end of the ring
+
+// Record header. The NUL terminated text follows, the whole record is
+// padded to 4 bytes and never wraps around the end of the ring
+typedef struct {
+    u16 length;
+    u8 level;
+    volatile u8 ready;  // Set last, once the text is in place
+} klog_record_t;
+
+static u8 klog_ring[KLOG_RING_SIZE] __attribute__((aligned(4)));
+static volatile u32 ring_head = 0;  // Next byte to hand out (free running)
+static volatile u32 ring_tail = 0;  // Oldest byte not flushed yet
+static volatile int flushing = 0;
+
+static int klog_sinks = KLOG_SINK_SCREEN;
+static int screen_level = KLOG_INFO;
+
+static u32 rate_tokens = KLOG_RATE_BURST;
+static u32 rate_tick = 0;
+
+static u32 records_written = 0;
+static u32 records_dropped = 0;
+static u32 records_suppressed = 0;
+static u32 suppressed_reported = 0;
+
+static char *level_names[] = { "[ERROR] ", "[WARN] ", "[INFO] ", "[DEBUG] " };
+
+void init_klog(void) {
+    if (init_serial()) {
+        klog_sinks |= KLOG_SINK_SERIAL;
+    }
+}
+
+void klog_set_sinks(int sinks, int level) {
+    klog_sinks = sinks;
+    screen_level = level;
+}
+
+void klog_get_stats(klog_stats_t *stats) {
+    if (!stats) return;
+    stats->written = records_written;
+    stats->dropped = records_dropped;
+    stats->suppressed = records_suppressed;
+}
+
+// Token bucket shared by everything below KLOG_ERROR. An interrupting
+// producer can race with the update; the worst case is one message more
+// or less getting through
+static int rate_allow(void) {
+    u32 refill = (tick - rate_tick) / KLOG_RATE_TICKS;
+    if (refill) {
+        rate_tick += refill * KLOG_RATE_TICKS;
+        rate_tokens += refill >= KLOG_RATE_BURST ? KLOG_RATE_BURST : refill;
+        if (rate_tokens > KLOG_RATE_BURST) rate_tokens = KLOG_RATE_BURST;
+    }
+    if (!rate_tokens) return 0;
+    rate_tokens--;
+    return 1;
+}
+
+static int put_number(char *buf, int pos, u32 value, u32 base) {
+    char digits[12];
+    int n = 0;
+    do {
+        u32 digit = value % base;
+        digits[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= base;
+    } while (value);
+    while (n && pos < KLOG_MAX_MESSAGE) buf[pos++] = digits[--n];
+    return pos;
+}
+
+static int format_message(char *buf, char *format, __builtin_va_list args) {
+    int pos = 0;
+    for (; *format && pos < KLOG_MAX_MESSAGE; format++) {
+        if (*format != '%') {
+            buf[pos++] = *format;
+            continue;
+        }
+        switch (*++format) {
+            case 'd': {
+                int value = __builtin_va_arg(args, int);
+                if (value < 0) {
+                    buf[pos++] = '-';
+                    pos = put_number(buf, pos, -(u32)value, 10);
+                } else {
+                    pos = put_number(buf, pos, value, 10);
+                }
+                break;
+            }
+            case 'u':
+                pos = put_number(buf, pos, __builtin_va_arg(args, u32), 10);
+                break;
+            case 'x':
+                pos = put_number(buf, pos, __builtin_va_arg(args, u32), 16);
+                break;
+            case 's': {
+                char *s = __builtin_va_arg(args, char*);
+                while (s && *s && pos < KLOG_MAX_MESSAGE) buf[pos++] = *s++;
+                break;
+            }
+            case 'c':
+                buf[pos++] = (char)__builtin_va_arg(args, int);
+                break;
+            case '\0':
+                format--;
+                break;
+            default:
+                buf[pos++] = *format;
+                break;
+        }
+    }
+    buf[pos] = '\0';
+    return pos;
+}
+
+// Claim 'length' bytes of the ring. Producers may be interrupted by other
+// producers (IRQ handlers), so the head moves with a compare-and-swap and
+// the reader stops at the first record whose ready flag is still clear.
+// Returns the record's offset or -1 when the ring is full
+static int ring_reserve(u32 length) {
+    u32 head, pad, next;
+    do {
+        head = ring_head;
+        u32 offset = head & KLOG_RING_MASK;
+        pad = offset + length > KLOG_RING_SIZE ? KLOG_RING_SIZE - offset : 0;
+        next = head + pad + length;
+        if (next - ring_tail > KLOG_RING_SIZE) {
+            return -1;
+        }
+    } while (!__sync_bool_compare_and_swap(&ring_head, head, next));
+
+    if (pad) {
+        klog_record_t *skip = (klog_record_t*)&klog_ring[head & KLOG_RING_MASK];
+        skip->length = pad;
+        skip->level = KLOG_SKIP;
+        __sync_synchronize();
+        skip->ready = 1;
+    }
+    return (head + pad) & KLOG_RING_MASK;
+}
+
+void klog_write(int level, char *format, ...) {
+    if (level > KLOG_ERROR && !rate_allow()) {
+        records_suppressed++;
+        return;
+    }
+
+    char text[KLOG_MAX_MESSAGE + 1];
+    __builtin_va_list args;
+    __builtin_va_start(args, format);
+    int len = format_message(text, format, args);
+    __builtin_va_end(args);
+
+    u32 length = (sizeof(klog_record_t) + len + 1 + 3) & ~3;
+    int offset = ring_reserve(length);
+    if (offset < 0) {
+        records_dropped++;
+        return;
+    }
+
+    klog_record_t *record = (klog_record_t*)&klog_ring[offset];
+    record->length = length;
+    record->level = level;
+    char *dest = (char*)(record + 1);
+    for (int i = 0; i <= len; i++) dest[i] = text[i];
+    __sync_synchronize();
+    record->ready = 1;
+    records_written++;
+}
+
+static void emit(int level, char *text) {
+    if ((klog_sinks & KLOG_SINK_SCREEN) && level <= screen_level) {
+        kprint(text);
+        kprint("\n");
+    }
+    if (klog_sinks & KLOG_SINK_SERIAL) {
+        serial_write(level_names[level]);
+        serial_write(text);
+        serial_write("\n");
+    }
+}
+
+// Write out everything logged so far. Meant for the idle loop, not for
+// the paths that log
+void klog_flush(void) {
+    // A single reader: a flush from an interrupt handler that lands in
+    // the middle of another one leaves the work to it
+    if (__sync_lock_test_and_set(&flushing, 1)) return;
+
+    while (ring_tail != ring_head) {
+        klog_record_t *record = (klog_record_t*)&klog_ring[ring_tail & KLOG_RING_MASK];
+        if (!record->ready) break;  // Still being written
+
+        if (record->level != KLOG_SKIP) {
+            emit(record->level, (char*)(record + 1));
+        }
+        u32 length = record->length;
+        record->ready = 0;
+        __sync_synchronize();
+        ring_tail += length;
+    }
+
+    if (records_suppressed != suppressed_reported) {
+        char text[KLOG_MAX_MESSAGE + 1];
+        u32 count = records_suppressed - suppressed_reported;
+        suppressed_reported = records_suppressed;
+        int pos = put_number(text, 0, count, 10);
+        char *suffix = " log messages suppressed";
+        while (*suffix) text[pos++] = *suffix++;
+        text[pos] = '\0';
+        emit(KLOG_WARN, text);
+    }
+
+    __sync_lock_release(&flushing);
+}
@@ -0,0 +1,53 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include "../cpu/types.h"
+
+// Log levels, most severe first
+#define KLOG_ERROR 0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+// Messages above this level are compiled out entirely. Build with
+// -DKLOG_COMPILE_LEVEL=KLOG_DEBUG to get the IPC/syscall traces back
+#ifndef KLOG_COMPILE_LEVEL
+#define KLOG_COMPILE_LEVEL KLOG_INFO
+#endif
+
+// Records are formatted into an in-memory ring and written to the
+// screen/serial port later by klog_flush(), so logging never waits on
+// device I/O. Warnings and below share a token bucket: KLOG_RATE_BURST
+// messages at once, then one per KLOG_RATE_TICKS timer ticks
+#define KLOG_RING_SIZE     4096  // Bytes, power of two
+#define KLOG_MAX_MESSAGE   120
+#define KLOG_RATE_BURST    32
+#define KLOG_RATE_TICKS    1
+
+// Where flushed records go
+#define KLOG_SINK_SCREEN 0x1
+#define KLOG_SINK_SERIAL 0x2
+
+typedef struct {
+    u32 written;      // Records that made it into the ring
+    u32 dropped;      // Ring full
+    u32 suppressed;   // Rate limited
+} klog_stats_t;
+
+void init_klog(void);
+// printf-style: %d %u %x %s %c and %%
+void klog_write(int level, char *format, ...) __attribute__((format(printf, 2, 3)));
+void klog_flush(void);
+void klog_set_sinks(int sinks, int screen_level);
+void klog_get_stats(klog_stats_t *stats);
+
+#define KLOG(level, ...) do { \
+        if ((level) <= KLOG_COMPILE_LEVEL) klog_write((level), __VA_ARGS__); \
+    } while (0)
+
+#define klog_error(...) KLOG(KLOG_ERROR, __VA_ARGS__)
+#define klog_warn(...)  KLOG(KLOG_WARN, __VA_ARGS__)
+#define klog_info(...)  KLOG(KLOG_INFO, __VA_ARGS__)
+#define klog_debug(...) KLOG(KLOG_DEBUG, __VA_ARGS__)
+
+#endif // KLOG_H
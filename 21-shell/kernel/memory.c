@@ -1,16 +1,33 @@
 #include "memory.h"
+#include "process.h"
+#include "pmm.h"
+#include "../cpu/paging.h"
+#include "../cpu/isr.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
+#include "../libc/mem.h"
+#include "klog.h"
 
-// Global memory region management
-memory_region_t memory_regions[MAX_MEMORY_REGIONS];
-int region_count = 0;
+// Global memory region management. Region ids are slots in
+// memory_regions and stay stable; freed slots are chained through their
+// 'start' field and reused. region_index holds the active slots sorted
+// by (process_id, start) so lookups and overlap checks are binary searches
+memory_region_t *memory_regions = 0;
+int region_count = 0;  // Slots handed out so far (high-water mark)
+static int region_capacity = 0;
+static u16 *region_index = 0;
+static int indexed_count = 0;
+static int free_slot_head = -1;
 
 // Initialize memory regions
 void init_memory_regions(void) {
     // Clear all memory regions
-    memset(memory_regions, 0, sizeof(memory_regions));
+    if (memory_regions) {
+        memset(memory_regions, 0, region_capacity * sizeof(memory_region_t));
+    }
     region_count = 0;
+    indexed_count = 0;
+    free_slot_head = -1;
     
     // Allocate kernel memory regions
     allocate_memory_region(0x00000000, 0x00010000, 
@@ -28,25 +45,86 @@ void init_memory_regions(void) {
     kprint("Memory regions initialized\n");
 }
 
-// Allocate a memory region
-int allocate_memory_region(u32 start, u32 size, int permissions, int process_id, int type) {
-    if (region_count >= MAX_MEMORY_REGIONS) {
-        kprint("Error: Maximum memory regions reached\n");
-        return -1;
-    }
-    
-    // Check for overlapping regions
-    for (int i = 0; i < region_count; i++) {
-        if (memory_regions[i].active) {
-            if ((start < memory_regions[i].end) && 
-                (start + size > memory_regions[i].start)) {
-                kprint("Error: Memory region overlap\n");
-                return -1;
-            }
+// Double the slot table and the index (starts at MEMORY_REGIONS_INITIAL)
+static int grow_memory_regions(void) {
+    int capacity = region_capacity ? region_capacity * 2 : MEMORY_REGIONS_INITIAL;
+    if (capacity > MEMORY_REGIONS_LIMIT) {
+        return 0;
+    }
+    
+    memory_region_t *regions = (memory_region_t*)kmalloc(capacity * sizeof(memory_region_t), 0, 0);
+    u16 *index = (u16*)kmalloc(capacity * sizeof(u16), 0, 0);
+    if (!regions || !index) {
+        kfree((u32)regions);
+        kfree((u32)index);
+        return 0;
+    }
+    
+    memset(regions, 0, capacity * sizeof(memory_region_t));
+    if (memory_regions) {
+        memory_copy((u8*)memory_regions, (u8*)regions, region_count * sizeof(memory_region_t));
+        memory_copy((u8*)region_index, (u8*)index, indexed_count * sizeof(u16));
+        kfree((u32)memory_regions);
+        kfree((u32)region_index);
+    }
+    
+    memory_regions = regions;
+    region_index = index;
+    region_capacity = capacity;
+    return 1;
+}
+
+// Position of the first indexed region ordered after (process_id, address)
+static int index_upper_bound(int process_id, u32 address) {
+    int lo = 0, hi = indexed_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        memory_region_t *region = &memory_regions[region_index[mid]];
+        if (region->process_id < process_id ||
+            (region->process_id == process_id && region->start <= address)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int add_region(u32 start, u32 size, int permissions, int process_id, int type) {
+    // Check for overlapping regions. Frames are owned through the frame
+    // allocator, so only a process' own regions can collide (user window
+    // addresses repeat across address spaces). A process' regions never
+    // overlap each other, so only the two neighbours need checking
+    int pos = index_upper_bound(process_id, start);
+    if (pos > 0) {
+        memory_region_t *prev = &memory_regions[region_index[pos - 1]];
+        if (prev->process_id == process_id && prev->end > start) {
+            klog_warn("Memory region overlap at %x (PID: %d)", start, process_id);
+            return -1;
+        }
+    }
+    if (pos < indexed_count) {
+        memory_region_t *next = &memory_regions[region_index[pos]];
+        if (next->process_id == process_id && next->start < start + size) {
+            klog_warn("Memory region overlap at %x (PID: %d)", start, process_id);
+            return -1;
         }
     }
     
-    memory_region_t *region = &memory_regions[region_count++];
+    // Reuse a freed slot before growing the table
+    int region_id;
+    if (free_slot_head != -1) {
+        region_id = free_slot_head;
+        free_slot_head = (int)memory_regions[region_id].start;
+    } else {
+        if (region_count >= region_capacity && !grow_memory_regions()) {
+            klog_warn("Maximum memory regions reached");
+            return -1;
+        }
+        region_id = region_count++;
+    }
+    
+    memory_region_t *region = &memory_regions[region_id];
     region->start = start;
     region->end = start + size;
     region->permissions = permissions;
@@ -54,41 +132,92 @@ int allocate_memory_region(u32 start, u32 size, int permissions, int process_id,
     region->type = type;
     region->active = 1;
     
-    kprint("Memory region allocated: ");
-    char addr_str[10];
-    int_to_ascii(start, addr_str);
-    kprint(addr_str);
-    kprint(" - ");
-    int_to_ascii(start + size, addr_str);
-    kprint(addr_str);
-    kprint(" (PID: ");
-    int_to_ascii(process_id, addr_str);
-    kprint(addr_str);
-    kprint(")\n");
-    
-    return region_count - 1;
+    for (int i = indexed_count; i > pos; i--) {
+        region_index[i] = region_index[i - 1];
+    }
+    region_index[pos] = region_id;
+    indexed_count++;
+    
+    klog_debug("Memory region allocated: %x - %x (PID: %d)", start, start + size, process_id);
+    
+    return region_id;
 }
 
-// Check memory access permissions
+// Allocate a memory region. Page faults of other processes read the
+// table, so it only changes with interrupts off
+int allocate_memory_region(u32 start, u32 size, int permissions, int process_id, int type) {
+    u32 flags = irq_save();
+    int region_id = add_region(start, size, permissions, process_id, type);
+    irq_restore(flags);
+    return region_id;
+}
+
+// Check memory access permissions against the process' page tables.
+// Mapped pages are a single table walk; unmapped pages fall back to the
+// VMA that will back them on first touch
 int check_memory_access(u32 address, int process_id, int access_type) {
-    for (int i = 0; i < region_count; i++) {
-        if (memory_regions[i].active && 
-            address >= memory_regions[i].start && 
-            address < memory_regions[i].end) {
-            
-            // Check if process owns this region
-            if (memory_regions[i].process_id == process_id) {
-                // Check if access type is allowed
-                return (memory_regions[i].permissions & access_type) == access_type;
-            } else {
-                // Access denied - wrong process
-                return 0;
-            }
+    process_t *proc = get_process(process_id);
+    if (!proc || !proc->page_directory) {
+        return 0;
+    }
+    
+    u32 pte = paging_get_entry(proc->page_directory, address);
+    if (pte & PAGE_PRESENT) {
+        if (proc->privileges != PRIVILEGE_KERNEL && !(pte & PAGE_USER)) {
+            return 0; // Supervisor page
         }
+        if ((access_type & PERMISSION_WRITE) && !(pte & PAGE_WRITE)) {
+            return 0; // Read-only page
+        }
+        return 1;
     }
     
-    // Access denied - no region found
-    return 0;
+    int region_id = find_memory_region(address, process_id);
+    if (region_id == -1) {
+        return 0; // Access denied - no region found
+    }
+    return (memory_regions[region_id].permissions & access_type) == access_type;
+}
+
+// Demand paging: back the faulting page with a fresh frame if it lies in
+// one of the process' user window regions and the access is allowed.
+// Returns 1 when the fault was resolved
+int resolve_page_fault(u32 address, int process_id, int write) {
+    if (address < USER_SPACE_START || address >= USER_SPACE_END) {
+        return 0;
+    }
+    
+    process_t *proc = get_process(process_id);
+    if (!proc || !proc->page_directory || proc->page_directory == kernel_directory) {
+        return 0;
+    }
+    
+    int region_id = find_memory_region(address, process_id);
+    if (region_id == -1) {
+        return 0;
+    }
+    
+    memory_region_t *region = &memory_regions[region_id];
+    int needed = write ? PERMISSION_WRITE : PERMISSION_READ;
+    if (!(region->permissions & needed)) {
+        return 0;
+    }
+    
+    u32 frame = pmm_alloc_frame();
+    if (!frame) {
+        return 0;
+    }
+    memset((void*)frame, 0, PAGE_SIZE);
+    
+    u32 flags = PAGE_USER;
+    if (region->permissions & PERMISSION_WRITE) {
+        flags |= PAGE_WRITE;
+    }
+    if (!paging_map_page(proc->page_directory, address & PAGE_FRAME_MASK, frame, flags)) {
+        pmm_free_frame(frame);
+        return 0;
+    }
+    return 1;
 }
 
 // Trigger a page fault for memory access violation
@@ -99,53 +228,115 @@ void trigger_page_fault(u32 address) {
     *ptr = 0; // This will trigger a page fault if address is invalid
 }
 
-// Find memory region by address
-int find_memory_region(u32 address) {
-    for (int i = 0; i < region_count; i++) {
-        if (memory_regions[i].active && 
-            address >= memory_regions[i].start && 
-            address < memory_regions[i].end) {
-            return i;
-        }
+// Find a region of the given process containing 'address'
+int find_memory_region(u32 address, int process_id) {
+    int pos = index_upper_bound(process_id, address) - 1;
+    if (pos < 0) {
+        return -1;  // Region not found
+    }
+    
+    int region_id = region_index[pos];
+    memory_region_t *region = &memory_regions[region_id];
+    if (region->process_id == process_id && address < region->end) {
+        return region_id;
     }
     return -1;  // Region not found
 }
 
+// Lowest page aligned address in [base, limit) where 'size' bytes fit
+// between the process' regions. Returns 0 when there is no such gap
+u32 find_free_range(int process_id, u32 base, u32 limit, u32 size) {
+    u32 candidate = base;
+    
+    // Start at the region that may straddle 'base'
+    int pos = index_upper_bound(process_id, base) - 1;
+    if (pos < 0 || memory_regions[region_index[pos]].process_id != process_id) {
+        pos++;
+    }
+    
+    for (; pos < indexed_count; pos++) {
+        memory_region_t *region = &memory_regions[region_index[pos]];
+        if (region->process_id != process_id || region->start >= limit) break;
+        if (region->end <= candidate) continue;
+        if (region->start >= candidate + size) break;
+        candidate = (region->end + PAGE_SIZE - 1) & PAGE_FRAME_MASK;
+    }
+    
+    if (candidate + size > limit || candidate + size < candidate) {
+        return 0;
+    }
+    return candidate;
+}
+
 // Free a memory region
 void free_memory_region(int region_id) {
-    if (region_id >= 0 && region_id < region_count) {
-        memory_regions[region_id].active = 0;
-        kprint("Memory region freed: ");
-        char addr_str[10];
-        int_to_ascii(memory_regions[region_id].start, addr_str);
-        kprint(addr_str);
-        kprint("\n");
+    u32 flags = irq_save();
+    if (region_id >= 0 && region_id < region_count && memory_regions[region_id].active) {
+        memory_region_t *region = &memory_regions[region_id];
+        
+        // Release whatever demand paging mapped into the region, or the
+        // heap block it stands for
+        process_t *proc = get_process(region->process_id);
+        if (region->type == MEMORY_TYPE_ALLOC) {
+            kfree(region->start);
+        } else if (region->start >= USER_SPACE_START && proc && proc->page_directory &&
+                   proc->page_directory != kernel_directory) {
+            for (u32 page = region->start & PAGE_FRAME_MASK; page < region->end; page += PAGE_SIZE) {
+                u32 frame = paging_unmap_page(proc->page_directory, page);
+                if (frame) pmm_free_frame(frame);
+            }
+        }
+        
+        klog_debug("Memory region freed: %x", region->start);
+        
+        // Drop it from the index and put the slot on the free list
+        int pos = index_upper_bound(region->process_id, region->start) - 1;
+        for (int i = pos; i < indexed_count - 1; i++) {
+            region_index[i] = region_index[i + 1];
+        }
+        indexed_count--;
+        
+        region->active = 0;
+        region->start = (u32)free_slot_head;
+        free_slot_head = region_id;
     }
+    irq_restore(flags);
 }
 
-// Print all memory regions (for debugging)
+// Free every region owned by a process. They sit next to each other in
+// the index, so this never looks at other processes' regions
+void free_process_regions(int process_id) {
+    u32 flags = irq_save();
+    int pos = index_upper_bound(process_id - 1, 0xFFFFFFFF);
+    while (pos < indexed_count &&
+           memory_regions[region_index[pos]].process_id == process_id) {
+        free_memory_region(region_index[pos]);
+    }
+    irq_restore(flags);
+}
+
+// Print all memory regions (for debugging), ordered by owner and address
 void print_memory_regions(void) {
     kprint("Memory Regions:\n");
-    for (int i = 0; i < region_count; i++) {
-        if (memory_regions[i].active) {
-            char addr_str[10];
-            
-            kprint("Region ");
-            int_to_ascii(i, addr_str);
-            kprint(addr_str);
-            kprint(": ");
-            
-            int_to_ascii(memory_regions[i].start, addr_str);
-            kprint(addr_str);
-            kprint(" - ");
-            
-            int_to_ascii(memory_regions[i].end, addr_str);
-            kprint(addr_str);
-            kprint(" (PID: ");
-            
-            int_to_ascii(memory_regions[i].process_id, addr_str);
-            kprint(addr_str);
-            kprint(")\n");
-        }
+    for (int pos = 0; pos < indexed_count; pos++) {
+        int i = region_index[pos];
+        char addr_str[12];
+        
+        kprint("Region ");
+        int_to_ascii(i, addr_str);
+        kprint(addr_str);
+        kprint(": ");
+        
+        int_to_ascii(memory_regions[i].start, addr_str);
+        kprint(addr_str);
+        kprint(" - ");
+        
+        int_to_ascii(memory_regions[i].end, addr_str);
+        kprint(addr_str);
+        kprint(" (PID: ");
+        
+        int_to_ascii(memory_regions[i].process_id, addr_str);
+        kprint(addr_str);
+        kprint(")\n");
     }
-} 
\ No newline at end of file
+}
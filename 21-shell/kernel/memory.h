@@ -8,6 +8,8 @@
 #define MEMORY_TYPE_DATA  1
 #define MEMORY_TYPE_STACK 2
 #define MEMORY_TYPE_HEAP  3
+#define MEMORY_TYPE_IPC   4  // Mapped zero-copy IPC buffer
+#define MEMORY_TYPE_ALLOC 5  // Kernel heap block from the ALLOC system call
 
 // Memory permissions
 #define PERMISSION_READ    0x01
@@ -19,25 +21,30 @@ typedef struct {
     u32 start;
     u32 end;
     int permissions;  // READ, WRITE, EXECUTE
-    int process_id;   // Owner process
+    int process_id;   // Owner process (user window addresses are per process)
     int type;         // CODE, DATA, STACK, HEAP
     int active;       // 1 if active, 0 if freed
 } memory_region_t;
 
-// Memory management constants
-#define MAX_MEMORY_REGIONS 64
+// Memory management constants. The region table starts small and
+// doubles on demand from the kernel heap
+#define MEMORY_REGIONS_INITIAL 64
+#define MEMORY_REGIONS_LIMIT   0x10000  // Region ids are indexed as u16
 #define MEMORY_REGION_SIZE 0x1000  // 4KB default size
 
-// Global memory region management
-extern memory_region_t memory_regions[MAX_MEMORY_REGIONS];
+// Global memory region management (indexed by region id, check 'active')
+extern memory_region_t *memory_regions;
 extern int region_count;
 
 // Function declarations
 int allocate_memory_region(u32 start, u32 size, int permissions, int process_id, int type);
 int check_memory_access(u32 address, int process_id, int access_type);
 void trigger_page_fault(u32 address);
+int resolve_page_fault(u32 address, int process_id, int write);
 void free_memory_region(int region_id);
-int find_memory_region(u32 address);
+void free_process_regions(int process_id);
+int find_memory_region(u32 address, int process_id);
+u32 find_free_range(int process_id, u32 base, u32 limit, u32 size);
 void init_memory_regions(void);
 void print_memory_regions(void);
 
@@ -1,4 +1,5 @@
 #include "mpu.h"
+#include "memory.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
 
@@ -57,26 +58,11 @@ int allocate_mpu_region(u32 start, u32 size, u8 permissions, u8 process_id, u8 t
     return region->region_id;
 }
 
-// Check MPU access permissions
+// Check MPU access permissions. The page tables are authoritative now
+// that every process has its own address space; MPU regions are kept for
+// bookkeeping and violation reports
 int check_mpu_access(u32 address, u8 process_id, u8 access_type) {
-    for (int i = 0; i < mpu_region_count; i++) {
-        if (mpu_regions[i].active && 
-            address >= mpu_regions[i].start && 
-            address < mpu_regions[i].end) {
-            
-            // Check if process owns this region
-            if (mpu_regions[i].process_id == process_id) {
-                // Check if access type is allowed
-                return (mpu_regions[i].permissions & access_type) == access_type;
-            } else {
-                // Access denied - wrong process
-                return 0;
-            }
-        }
-    }
-    
-    // Access denied - no region found
-    return 0;
+    return check_memory_access(address, process_id, access_type);
 }
 
 // Find MPU region by address
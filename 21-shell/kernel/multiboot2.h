@@ -15,6 +15,9 @@
 // Multiboot2 header checksum
 #define MULTIBOOT2_HEADER_CHECKSUM 0x100000000 - (MULTIBOOT2_HEADER_MAGIC + MULTIBOOT2_ARCHITECTURE_I386 + MULTIBOOT2_HEADER_FLAGS)
 
+// Value left in eax by a multiboot2 compliant loader
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36D76289
+
 // Multiboot2 info structure
 typedef struct {
     u32 total_size;
@@ -59,7 +62,27 @@ typedef struct {
     u32 zero;
 } multiboot2_memory_map_t;
 
-// External multiboot2 info
+// Memory map tag (type 6), followed by the entries
+typedef struct {
+    u32 type;
+    u32 size;
+    u32 entry_size;
+    u32 entry_version;
+} multiboot2_tag_mmap_t;
+
+// Memory map entry types
+#define MULTIBOOT2_MEMORY_AVAILABLE        1
+#define MULTIBOOT2_MEMORY_RESERVED         2
+#define MULTIBOOT2_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT2_MEMORY_NVS              4
+#define MULTIBOOT2_MEMORY_BADRAM           5
+
+// Tags are padded to 8 bytes
+#define MULTIBOOT2_TAG_ALIGN 8
+
+// External multiboot2 info (saved by boot/kernel_entry_limine.asm,
+// both stay 0 when booted from the floppy boot sector)
 extern u32 multiboot2_info;
+extern u32 multiboot2_magic;
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "pmm.h"
+#include "multiboot2.h"
+#include "../cpu/ports.h"
+#include "../cpu/isr.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+
+// End of the kernel image (bss included), provided by the linker
+extern char _end[];
+
+// Saved by the multiboot2 entry stub, left at 0 by the floppy boot path
+u32 multiboot2_info = 0;
+u32 multiboot2_magic = 0;
+
+// Memory map as reported by the firmware (kept for print_memory_map)
+#define PMM_MAX_RANGES 32
+typedef struct {
+    u32 start;
+    u32 end;
+    u32 type;
+} pmm_range_t;
+
+static pmm_range_t pmm_ranges[PMM_MAX_RANGES];
+static int pmm_range_count = 0;
+
+// One bit per frame, 1 = in use. Placed in RAM found at boot
+static u32 *frame_bitmap = 0;
+static u32 bitmap_words = 0;
+static u32 total_frames = 0;
+static u32 usable_frames = 0;
+static u32 free_frames = 0;
+static u32 highest_address = 0;
+static u32 search_word = 0;  // No free frame below this bitmap word
+
+#define FRAME_USED(f) (frame_bitmap[(f) / 32] & (1u << ((f) % 32)))
+#define ALIGN_UP(x)   (((x) + PMM_FRAME_SIZE - 1) & ~(PMM_FRAME_SIZE - 1))
+#define ALIGN_DOWN(x) ((x) & ~(PMM_FRAME_SIZE - 1))
+#define PMM_ADDRESS_LIMIT 0xFFFFF000ULL
+
+static void add_range(u64 start, u64 len, u32 type) {
+    if (pmm_range_count >= PMM_MAX_RANGES || len == 0) return;
+
+    // Without PAE we can only address the first 4GB (minus the last
+    // frame, so range ends never wrap to 0)
+    u64 end = start + len;
+    if (end > PMM_ADDRESS_LIMIT) end = PMM_ADDRESS_LIMIT;
+    if (start >= end) return;
+
+    pmm_range_t *range = &pmm_ranges[pmm_range_count++];
+    range->start = (u32)start;
+    range->end = (u32)end;
+    range->type = type;
+
+    if (type == MULTIBOOT2_MEMORY_AVAILABLE) {
+        u32 top = ALIGN_DOWN(range->end);
+        if (top > highest_address) highest_address = top;
+    }
+}
+
+// Walk the multiboot2 tag list looking for the memory map
+static int parse_multiboot2_mmap(u32 info) {
+    u32 total_size = ((multiboot2_info_t*)info)->total_size;
+    u32 tag_addr = info + 8;
+
+    while (tag_addr < info + total_size) {
+        multiboot2_tag_t *tag = (multiboot2_tag_t*)tag_addr;
+        if (tag->type == MULTIBOOT2_TAG_TYPE_END) break;
+
+        if (tag->type == MULTIBOOT2_TAG_TYPE_MMAP) {
+            multiboot2_tag_mmap_t *mmap = (multiboot2_tag_mmap_t*)tag;
+            u32 entry = tag_addr + sizeof(multiboot2_tag_mmap_t);
+            while (entry + mmap->entry_size <= tag_addr + tag->size) {
+                multiboot2_memory_map_t *e = (multiboot2_memory_map_t*)entry;
+                add_range(e->addr, e->len, e->type);
+                entry += mmap->entry_size;
+            }
+            return 1;
+        }
+
+        tag_addr += (tag->size + MULTIBOOT2_TAG_ALIGN - 1) & ~(MULTIBOOT2_TAG_ALIGN - 1);
+    }
+    return 0;
+}
+
+static u8 cmos_read(u8 reg) {
+    port_byte_out(0x70, reg);
+    return port_byte_in(0x71);
+}
+
+// Floppy boot: no loader handed us a map, so rebuild a coarse one from
+// the sizes the BIOS stored in CMOS during POST
+static void probe_cmos_memory(void) {
+    add_range(0, 0x9F000, MULTIBOOT2_MEMORY_AVAILABLE);
+
+    // 0x30/0x31: KB above 1MB, saturates at 15MB
+    u32 ext_kb = cmos_read(0x30) | (cmos_read(0x31) << 8);
+    if (ext_kb > 15 * 1024) ext_kb = 15 * 1024;
+    add_range(0x100000, (u64)ext_kb * 1024, MULTIBOOT2_MEMORY_AVAILABLE);
+
+    // 0x34/0x35: 64KB blocks above 16MB
+    u32 high_blocks = cmos_read(0x34) | (cmos_read(0x35) << 8);
+    add_range(0x1000000, (u64)high_blocks * 0x10000, MULTIBOOT2_MEMORY_AVAILABLE);
+}
+
+static void mark_frames(u32 first, u32 count, int used) {
+    for (u32 f = first; f < first + count && f < total_frames; f++) {
+        u32 mask = 1u << (f % 32);
+        if (used && !(frame_bitmap[f / 32] & mask)) {
+            frame_bitmap[f / 32] |= mask;
+            free_frames--;
+        } else if (!used && (frame_bitmap[f / 32] & mask)) {
+            frame_bitmap[f / 32] &= ~mask;
+            free_frames++;
+        }
+    }
+}
+
+// Find room for the bitmap in usable RAM above the kernel image
+// that does not cover the multiboot2 info block
+static u32 place_bitmap(u32 bytes, u32 kernel_end, u32 info_start, u32 info_end) {
+    for (int i = 0; i < pmm_range_count; i++) {
+        pmm_range_t *range = &pmm_ranges[i];
+        if (range->type != MULTIBOOT2_MEMORY_AVAILABLE) continue;
+
+        u32 start = ALIGN_UP(range->start > kernel_end ? range->start : kernel_end);
+        if (start < info_end && start + bytes > info_start) {
+            start = ALIGN_UP(info_end);
+        }
+        if (start >= range->start && start + bytes <= range->end) {
+            return start;
+        }
+    }
+    return 0;
+}
+
+// Initialize the physical frame allocator
+void init_pmm(u32 mb2_magic, u32 mb2_info) {
+    pmm_range_count = 0;
+    highest_address = 0;
+
+    u32 info_start = 0, info_end = 0;
+    int have_map = 0;
+    if (mb2_magic == MULTIBOOT2_BOOTLOADER_MAGIC && mb2_info) {
+        info_start = mb2_info;
+        info_end = mb2_info + ((multiboot2_info_t*)mb2_info)->total_size;
+        have_map = parse_multiboot2_mmap(mb2_info);
+    }
+    if (!have_map) {
+        probe_cmos_memory();
+    }
+
+    total_frames = highest_address >> PMM_FRAME_SHIFT;
+    bitmap_words = (total_frames + 31) / 32;
+
+    u32 kernel_end = (u32)_end;
+    if (kernel_end < PMM_LOW_MEMORY_END) kernel_end = PMM_LOW_MEMORY_END;
+
+    u32 bitmap_bytes = bitmap_words * 4;
+    u32 bitmap_addr = place_bitmap(bitmap_bytes, kernel_end, info_start, info_end);
+    if (!bitmap_addr) {
+        kprint("PMM: No room for the frame bitmap!\n");
+        return;
+    }
+    frame_bitmap = (u32*)bitmap_addr;
+
+    // Start with everything in use, then open up what the map says is RAM
+    for (u32 w = 0; w < bitmap_words; w++) frame_bitmap[w] = 0xFFFFFFFF;
+    free_frames = 0;
+    for (int i = 0; i < pmm_range_count; i++) {
+        pmm_range_t *range = &pmm_ranges[i];
+        if (range->type != MULTIBOOT2_MEMORY_AVAILABLE) continue;
+        u32 first = ALIGN_UP(range->start) >> PMM_FRAME_SHIFT;
+        u32 last = ALIGN_DOWN(range->end) >> PMM_FRAME_SHIFT;
+        if (last > first) mark_frames(first, last - first, 0);
+    }
+    usable_frames = free_frames;
+
+    // Low memory, kernel image/bss/boot stack, loader info and the bitmap
+    pmm_reserve_range(0, kernel_end);
+    if (info_end) pmm_reserve_range(info_start, info_end);
+    pmm_reserve_range(bitmap_addr, bitmap_addr + bitmap_bytes);
+    search_word = 0;
+
+    kprint("PMM: ");
+    char num_str[12];
+    int_to_ascii(free_frames * (PMM_FRAME_SIZE / 1024), num_str);
+    kprint(num_str);
+    kprint(" KB free of ");
+    int_to_ascii(usable_frames * (PMM_FRAME_SIZE / 1024), num_str);
+    kprint(num_str);
+    kprint(" KB usable");
+    kprint(have_map ? " (multiboot2 map)\n" : " (CMOS probe)\n");
+}
+
+// Mark [start, end) as in use
+void pmm_reserve_range(u32 start, u32 end) {
+    if (!frame_bitmap || end <= start) return;
+    u32 first = ALIGN_DOWN(start) >> PMM_FRAME_SHIFT;
+    u32 last = ALIGN_UP(end) >> PMM_FRAME_SHIFT;
+    mark_frames(first, last - first, 1);
+}
+
+// Allocate one 4KB frame. Full bitmap words are skipped 32 frames at a
+// time and the search resumes where the last one succeeded, so this is
+// O(1) amortized. Returns 0 when out of memory (frame 0 is never free)
+static u32 alloc_frame(void) {
+    for (u32 w = search_word; w < bitmap_words; w++) {
+        if (frame_bitmap[w] == 0xFFFFFFFF) continue;
+
+        u32 frame = w * 32 + __builtin_ctz(~frame_bitmap[w]);
+        if (frame >= total_frames) break;
+
+        frame_bitmap[w] |= 1u << (frame % 32);
+        free_frames--;
+        search_word = w;
+        return frame << PMM_FRAME_SHIFT;
+    }
+    return 0;
+}
+
+// Allocate 'count' physically contiguous frames (first fit)
+static u32 alloc_frames(u32 count) {
+    if (count == 1) return alloc_frame();
+    if (count == 0 || count > free_frames) return 0;
+
+    u32 run = 0;
+    for (u32 f = search_word * 32; f < total_frames; f++) {
+        if (FRAME_USED(f)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            u32 first = f + 1 - count;
+            mark_frames(first, count, 1);
+            return first << PMM_FRAME_SHIFT;
+        }
+    }
+    return 0;
+}
+
+// Page faults in preempted processes allocate too: the bitmap is only
+// changed with interrupts off
+u32 pmm_alloc_frame(void) {
+    u32 flags = irq_save();
+    u32 addr = alloc_frame();
+    irq_restore(flags);
+    return addr;
+}
+
+u32 pmm_alloc_frames(u32 count) {
+    u32 flags = irq_save();
+    u32 addr = alloc_frames(count);
+    irq_restore(flags);
+    return addr;
+}
+
+void pmm_free_frame(u32 addr) {
+    pmm_free_frames(addr, 1);
+}
+
+void pmm_free_frames(u32 addr, u32 count) {
+    u32 first = addr >> PMM_FRAME_SHIFT;
+    if (!frame_bitmap || first == 0 || first + count > total_frames) return;
+
+    u32 flags = irq_save();
+    mark_frames(first, count, 0);
+    if (first / 32 < search_word) search_word = first / 32;
+    irq_restore(flags);
+}
+
+void pmm_get_stats(pmm_stats_t *stats) {
+    if (!stats) return;
+    stats->total_frames = total_frames;
+    stats->usable_frames = usable_frames;
+    stats->free_frames = free_frames;
+    stats->reserved_frames = usable_frames - free_frames;
+    stats->highest_address = highest_address;
+}
+
+// Print the firmware memory map (in KB, addresses don't fit int_to_ascii)
+void print_memory_map(void) {
+    kprint("Physical memory map (KB):\n");
+    for (int i = 0; i < pmm_range_count; i++) {
+        char num_str[12];
+        kprint("  ");
+        int_to_ascii(pmm_ranges[i].start / 1024, num_str);
+        kprint(num_str);
+        kprint(" - ");
+        int_to_ascii(pmm_ranges[i].end / 1024, num_str);
+        kprint(num_str);
+        kprint(pmm_ranges[i].type == MULTIBOOT2_MEMORY_AVAILABLE ? " usable\n" : " reserved\n");
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "../cpu/types.h"
+
+// Physical frame geometry
+#define PMM_FRAME_SIZE  0x1000
+#define PMM_FRAME_SHIFT 12
+
+// Everything below 1MB (IVT, BDA, floppy-loaded kernel, boot stack,
+// EBDA, VGA memory and BIOS ROM) is never handed out
+#define PMM_LOW_MEMORY_END 0x100000
+
+// Physical memory statistics
+typedef struct {
+    u32 total_frames;     // Frames covered by the bitmap
+    u32 usable_frames;    // Frames the firmware reported as RAM
+    u32 free_frames;
+    u32 reserved_frames;  // Usable RAM held by the kernel image, bitmap, etc.
+    u32 highest_address;  // End of the highest usable RAM range
+} pmm_stats_t;
+
+// Function declarations
+void init_pmm(u32 mb2_magic, u32 mb2_info);
+u32 pmm_alloc_frame(void);
+u32 pmm_alloc_frames(u32 count);
+void pmm_free_frame(u32 addr);
+void pmm_free_frames(u32 addr, u32 count);
+void pmm_reserve_range(u32 start, u32 end);
+void pmm_get_stats(pmm_stats_t *stats);
+void print_memory_map(void);
+
+#endif // PMM_H
@@ -3,55 +3,307 @@
 #include "../libc/string.h"
 #include "../drivers/screen.h"
 #include "../cpu/gdt.h"
+#include "../cpu/paging.h"
+#include "../cpu/isr.h"
+#include "../cpu/fpu.h"
+#include "../cpu/timer.h"
+#include "../cpu/clock.h"
 #include "memory.h"
+#include "pmm.h"
+#include "ipc.h"
+#include "klog.h"
+#include "syscall_ring.h"
 
 #define NULL ((void*)0)
 
 // Global process management variables
 process_t *current_process = NULL;
-process_t processes[MAX_PROCESSES];
-int next_pid = 1;
+
+// Process table: one slot per live process. Free slots are chained
+// through next_free; 'generation' counts the owners a slot has had
+typedef struct {
+    process_t *proc;
+    u32 generation;
+    int next_free;
+} process_slot_t;
+
+static process_slot_t *process_table = NULL;
+static u32 table_capacity = 0;
+static int free_slot = -1;
+
+// Terminated processes that still have to leave their kernel stack
+static process_t *zombies = NULL;
+
+// Set when the running process should give up the CPU at the next
+// interrupt exit (time slice used up, a better process woke up, or
+// schedule() was called)
+static volatile int need_resched = 0;
+static int yield_requested = 0;
+static int scheduler_running = 0;
+static u32 boost_ticks = 0;
+
+// Runs only when no other process is ready; never on a ready list
+static process_t *idle_process = NULL;
+
+// Clocksource time the running process got the CPU
+static u64 last_switch_ns = 0;
+
+// Charge the running process for its time on the CPU so far
+static void account_running(void) {
+    u64 now = ktime_ns();
+    current_process->stats.run_ns += now - last_switch_ns;
+    last_switch_ns = now;
+}
+
+// One FIFO of READY processes per level and a bit per non-empty level,
+// so picking the next process is a bit scan. Only changed with
+// interrupts off
+static process_t *ready_head[SCHED_LEVELS];
+static process_t *ready_tail[SCHED_LEVELS];
+static u32 ready_levels = 0;
+
+static void ready_push(process_t *proc) {
+    int level = proc->level;
+    proc->next_ready = NULL;
+    proc->prev_ready = ready_tail[level];
+    if (ready_tail[level]) ready_tail[level]->next_ready = proc;
+    else ready_head[level] = proc;
+    ready_tail[level] = proc;
+    ready_levels |= 1u << level;
+}
+
+static void ready_remove(process_t *proc) {
+    int level = proc->level;
+    if (proc->prev_ready) proc->prev_ready->next_ready = proc->next_ready;
+    else ready_head[level] = proc->next_ready;
+    if (proc->next_ready) proc->next_ready->prev_ready = proc->prev_ready;
+    else ready_tail[level] = proc->prev_ready;
+    if (!ready_head[level]) ready_levels &= ~(1u << level);
+    proc->next_ready = NULL;
+    proc->prev_ready = NULL;
+}
+
+// Oldest process of the highest non-empty level
+static process_t *ready_pop(void) {
+    if (!ready_levels) return NULL;
+    process_t *proc = ready_head[__builtin_ctz(ready_levels)];
+    ready_remove(proc);
+    return proc;
+}
+
+static void set_level(process_t *proc, int level) {
+    proc->level = level;
+    proc->slice_left = SCHED_SLICE_TICKS(level);
+}
+
+// Lift everybody back to level 0, keeping the order within the lists
+static void boost_all(void) {
+    for (int level = 1; level < SCHED_LEVELS; level++) {
+        if (!ready_head[level]) continue;
+        if (ready_tail[0]) {
+            ready_tail[0]->next_ready = ready_head[level];
+            ready_head[level]->prev_ready = ready_tail[0];
+        } else {
+            ready_head[0] = ready_head[level];
+        }
+        ready_tail[0] = ready_tail[level];
+        ready_head[level] = NULL;
+        ready_tail[level] = NULL;
+    }
+    ready_levels = ready_head[0] ? 1 : 0;
+    
+    u32 cursor = 0;
+    process_t *proc;
+    while ((proc = next_process(&cursor))) {
+        if (proc != idle_process) set_level(proc, 0);
+    }
+}
+
+// Double the table (starts at PROCESS_TABLE_INITIAL slots), chaining
+// the new slots onto the free list in order
+static int grow_process_table(void) {
+    u32 capacity = table_capacity ? table_capacity * 2 : PROCESS_TABLE_INITIAL;
+    if (capacity > PROCESS_TABLE_LIMIT) {
+        return 0;
+    }
+    
+    process_slot_t *table = (process_slot_t*)kmalloc(capacity * sizeof(process_slot_t), 0, NULL);
+    if (!table) {
+        return 0;
+    }
+    memset(table, 0, capacity * sizeof(process_slot_t));
+    
+    u32 flags = irq_save();
+    if (process_table) {
+        memory_copy((u8*)process_table, (u8*)table, table_capacity * sizeof(process_slot_t));
+        kfree((u32)process_table);
+    }
+    for (u32 i = capacity; i > table_capacity; i--) {
+        table[i - 1].next_free = free_slot;
+        free_slot = i - 1;
+    }
+    process_table = table;
+    table_capacity = capacity;
+    irq_restore(flags);
+    return 1;
+}
+
+// Take a free slot and give 'proc' the PID for it
+static int assign_pid(process_t *proc) {
+    if (free_slot < 0 && !grow_process_table()) {
+        return 0;
+    }
+    
+    u32 flags = irq_save();
+    int slot = free_slot;
+    process_slot_t *entry = &process_table[slot];
+    free_slot = entry->next_free;
+    entry->proc = proc;
+    // Keep PIDs positive: the generation wraps before reaching the sign bit
+    proc->pid = (int)(((entry->generation & (0x7FFFFFFF >> PID_SLOT_BITS)) << PID_SLOT_BITS) | slot);
+    irq_restore(flags);
+    return 1;
+}
+
+// Give the slot back; the next owner gets a different PID
+static void release_pid(int pid) {
+    u32 flags = irq_save();
+    process_slot_t *entry = &process_table[PID_SLOT(pid)];
+    entry->proc = NULL;
+    entry->generation++;
+    entry->next_free = free_slot;
+    free_slot = PID_SLOT(pid);
+    irq_restore(flags);
+}
+
+// Last step of a process: everything left after terminate_process()
+static void reap_process(process_t *proc) {
+    fpu_release(proc);
+    release_process_segments(proc);
+    if (proc->owns_stack) {
+        pmm_free_frames((u32)proc->stack, proc->stack_size / PAGE_SIZE);
+    }
+    release_pid(proc->pid);
+    kfree((u32)proc);
+}
+
+// A process cannot free the stack it is running on; the ones that
+// terminated themselves are reaped once the CPU has left them
+static void reap_zombies(void) {
+    process_t **link = &zombies;
+    while (*link) {
+        process_t *proc = *link;
+        if (proc == current_process) {
+            link = &proc->next_ready;
+        } else {
+            *link = proc->next_ready;
+            reap_process(proc);
+        }
+    }
+}
+
+// Entry points return here (see create_process)
+static void process_exit(void) {
+    terminate_process(get_current_pid());
+    while (1) {
+        schedule();
+        asm volatile("hlt");
+    }
+}
 
 // Initialize process manager
 void init_process_manager(void) {
-    // Clear all processes
-    memset(processes, 0, sizeof(processes));
+    process_t *kernel_proc = (process_t*)kmalloc(sizeof(process_t), 0, NULL);
+    if (!kernel_proc || !grow_process_table()) {
+        kprint("Error: No memory for the process table\n");
+        return;
+    }
+    memset(kernel_proc, 0, sizeof(process_t));
     
-    // Create kernel process (PID 0)
-    process_t *kernel_proc = &processes[0];
-    kernel_proc->pid = 0;
+    // Create kernel process (PID 0: first slot, first generation)
+    assign_pid(kernel_proc);
     kernel_proc->state = PROCESS_RUNNING;
     kernel_proc->privileges = PRIVILEGE_KERNEL;
-    kernel_proc->stack = (void*)0x10000;  // Kernel stack
-    kernel_proc->heap = (void*)0x20000;   // Kernel heap
+    set_level(kernel_proc, 0);
+    
+    // The kernel keeps running on the stack it was booted with and
+    // allocates from the shared kernel heap
+    u32 esp;
+    asm volatile("mov %%esp, %0" : "=r"(esp));
+    kernel_proc->stack = (void*)(esp & 0xFFFFF000);
+    kernel_proc->heap = NULL;
+    kernel_proc->page_directory = kernel_directory;
     
     // Set current process to kernel
     current_process = kernel_proc;
+    last_switch_ns = ktime_ns();
     
     kprint("Process manager initialized\n");
 }
 
-// Create a new process
-process_t *create_process(void (*entry_point)(void), void *stack, int privileges) {
-    if (next_pid >= MAX_PROCESSES) {
-        kprint("Error: Maximum processes reached\n");
+// Create a process that starts in entry_point(arg). Without a 'stack'
+// it gets one of 'stack_size' bytes (whole pages)
+static process_t *spawn_process(void (*entry_point)(void), u32 arg, void *stack,
+                                u32 stack_size, int privileges) {
+    process_t *proc = (process_t*)kmalloc(sizeof(process_t), 0, NULL);
+    if (!proc) {
+        kprint("Error: No memory for process\n");
         return NULL;
     }
+    memset(proc, 0, sizeof(process_t));
     
-    process_t *proc = &processes[next_pid];
+    if (!stack) {
+        stack = (void*)pmm_alloc_frames(stack_size / PAGE_SIZE);
+        proc->owns_stack = 1;
+    }
+    proc->stack_size = stack_size;
+    if (!stack || !assign_pid(proc)) {
+        kprint(stack ? "Error: Process table full\n" : "Error: No stack for process\n");
+        if (stack && proc->owns_stack) pmm_free_frames((u32)stack, stack_size / PAGE_SIZE);
+        kfree((u32)proc);
+        return NULL;
+    }
     
     // Initialize process structure
-    proc->pid = next_pid++;
     proc->stack = stack;
-    proc->heap = (void*)kmalloc(0x1000, 1, NULL);  // 4KB heap
     proc->privileges = privileges;
-    proc->state = PROCESS_READY;
+    proc->state = PROCESS_BLOCKED;  // Not schedulable until fully set up
+    
+    // Kernel processes share the kernel address space and heap. User
+    // processes get their own directory with heap and stack in the user
+    // window, backed by frames on first touch
+    u32 user_stack = (u32)stack;
+    u32 user_stack_size = stack_size;
+    if (privileges == PRIVILEGE_KERNEL) {
+        proc->page_directory = kernel_directory;
+        proc->heap = (void*)kmalloc(0x1000, 1, NULL);  // 4KB heap
+    } else {
+        proc->page_directory = paging_create_directory();
+        if (!proc->page_directory) {
+            kprint("Error: No memory for process address space\n");
+            proc->state = PROCESS_TERMINATED;
+            reap_process(proc);
+            return NULL;
+        }
+        proc->heap = (void*)USER_HEAP_BASE;
+        user_stack = USER_STACK_TOP - 0x1000;
+        user_stack_size = 0x1000;
+    }
     
-    // Initialize registers
-    proc->regs.eip = (u32)entry_point;
-    proc->regs.esp = (u32)stack + 0x1000;  // Stack grows down
-    proc->regs.ebp = proc->regs.esp;
-    proc->regs.eflags = 0x202;  // Interrupts enabled
+    // The first switch to the process "returns" into the entry point
+    // through the frame the IRQ stub would have saved. A same-privilege
+    // iret leaves useresp/ss on the stack: they become the entry point's
+    // return address and its argument
+    u32 stack_top = (u32)stack + stack_size;
+    registers_t *frame = (registers_t*)(stack_top - sizeof(registers_t));
+    memset(frame, 0, sizeof(registers_t));
+    frame->ds = GDT_KERNEL_DATA;
+    frame->eip = (u32)entry_point;
+    frame->cs = GDT_KERNEL_CODE;
+    frame->eflags = 0x202;  // Interrupts enabled
+    frame->useresp = (u32)process_exit;
+    frame->ss = arg;
+    proc->context = (u32)frame;
     
     // Allocate memory regions for process
     u32 heap_start = (u32)proc->heap;
@@ -59,31 +311,28 @@ process_t *create_process(void (*entry_point)(void), void *stack, int privileges
                           PERMISSION_READ | PERMISSION_WRITE, 
                           proc->pid, MEMORY_TYPE_HEAP);
     
-    u32 stack_start = (u32)proc->stack;
-    allocate_memory_region(stack_start, 0x1000, 
+    allocate_memory_region(user_stack, user_stack_size, 
                           PERMISSION_READ | PERMISSION_WRITE, 
                           proc->pid, MEMORY_TYPE_STACK);
     
-    // Setup process-specific GDT segments
-    setup_process_segments(proc);
-    
-    // Set segment registers based on process segments
-    if (privileges == PRIVILEGE_KERNEL) {
-        proc->regs.cs = 0x08;  // Kernel code segment
-        proc->regs.ds = 0x10;  // Kernel data segment
-        proc->regs.es = 0x10;
-        proc->regs.fs = 0x10;
-        proc->regs.gs = 0x10;
-        proc->regs.ss = 0x10;
-    } else {
-        proc->regs.cs = proc->code_segment;  // Process-specific code segment
-        proc->regs.ds = proc->data_segment;  // Process-specific data segment
-        proc->regs.es = proc->data_segment;
-        proc->regs.fs = proc->data_segment;
-        proc->regs.gs = proc->data_segment;
-        proc->regs.ss = proc->data_segment;
+    // Private GDT segments, when there are descriptors left
+    if (!setup_process_segments(proc)) {
+        klog_warn("Process %d: no free GDT descriptors", proc->pid);
     }
     
+    // Until there is a TSS to return to ring 3 through, every process
+    // runs in ring 0 on its kernel stack with the flat kernel selectors.
+    // User processes only get a private user window: the kernel map is
+    // shared into their directory and nothing stops ring 0 from using it
+    
+    // New processes start at the top level and queue up behind the
+    // ones already waiting there
+    set_level(proc, 0);
+    u32 flags = irq_save();
+    proc->state = PROCESS_READY;
+    ready_push(proc);
+    irq_restore(flags);
+    
     kprint("Created process PID: ");
     char pid_str[10];
     int_to_ascii(proc->pid, pid_str);
@@ -93,20 +342,134 @@ process_t *create_process(void (*entry_point)(void), void *stack, int privileges
     return proc;
 }
 
-// Basic round-robin scheduler
+process_t *create_process(void (*entry_point)(void), void *stack, int privileges) {
+    return spawn_process(entry_point, 0, stack, PROCESS_STACK_SIZE, privileges);
+}
+
+// Kernel thread: a kernel process with its own stack, running entry(arg)
+process_t *create_kernel_thread(void (*entry)(void *arg), void *arg) {
+    return spawn_process((void (*)(void))entry, (u32)arg, NULL,
+                         KERNEL_THREAD_STACK_SIZE, PRIVILEGE_KERNEL);
+}
+
+// Boot setup is done: from now on the timer preempts processes
+void start_scheduler(void) {
+    boost_ticks = 0;
+    scheduler_running = 1;
+}
+
+// Give up the CPU. Returns once the scheduler picks this process again,
+// straight away when nothing else can run
 void schedule(void) {
-    static int current_index = 0;
-    
-    // Find next ready process
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        int index = (current_index + i) % MAX_PROCESSES;
-        if (processes[index].state == PROCESS_READY) {
-            // Switch to this process
-            switch_to_process(&processes[index]);
-            current_index = (index + 1) % MAX_PROCESSES;
-            break;
+    yield_requested = 1;
+    need_resched = 1;
+    asm volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+}
+
+// Timer interrupt: charge the running process 'ticks' ticks of its
+// slice (more than one after a tickless idle sleep)
+void scheduler_tick(u32 ticks) {
+    if (!current_process) return;
+    current_process->stats.ticks += ticks;
+    if (!scheduler_running) return;
+    
+    if (current_process == idle_process) {
+        if (ready_levels) need_resched = 1;
+    } else {
+        current_process->slice_left -= ticks < current_process->slice_left ? ticks : current_process->slice_left;
+        if (current_process->slice_left == 0) {
+            need_resched = 1;
         }
     }
+    boost_ticks += ticks;
+    if (boost_ticks >= SCHED_BOOST_TICKS) {
+        boost_ticks = 0;
+        boost_all();
+        need_resched = 1;
+    }
+}
+
+// Called by the IRQ stubs on the way out with the interrupted frame.
+// Returns the frame to resume, another process' one to switch
+u32 schedule_from_irq(u32 esp) {
+    if (zombies) {
+        reap_zombies();
+    }
+    if (!need_resched || !scheduler_running || !current_process) {
+        return esp;
+    }
+    need_resched = 0;
+    int voluntary = yield_requested || current_process->state != PROCESS_RUNNING;
+    yield_requested = 0;
+    
+    // The running process competes too: a used up slice costs it a
+    // level, otherwise it keeps what is left and goes to the back
+    process_t *prev = current_process;
+    if (prev->state == PROCESS_RUNNING && prev != idle_process) {
+        if (prev->slice_left == 0) {
+            set_level(prev, prev->level + 1 < SCHED_LEVELS ? prev->level + 1 : prev->level);
+        }
+        prev->state = PROCESS_READY;
+        ready_push(prev);
+    }
+    
+    // Nothing runnable: the idle task takes over. Before it exists the
+    // blocked process stays on and halts until an interrupt readies
+    // somebody
+    process_t *next = ready_pop();
+    if (!next) {
+        next = idle_process ? idle_process : prev;
+        if (next == prev) {
+            return esp;
+        }
+    }
+    next->state = PROCESS_RUNNING;
+    if (next == prev) {
+        return esp;
+    }
+    if (prev == idle_process) {
+        // Leaving an idle sleep early: the tick has to run again
+        timer_exit_idle();
+        prev->state = PROCESS_READY;
+    }
+    
+    account_running();
+    prev->stats.switches++;
+    if (voluntary) {
+        prev->stats.voluntary++;
+    } else {
+        prev->stats.involuntary++;
+    }
+    return switch_to_process(next, esp);
+}
+
+// The boot context turns into the idle task: off the ready lists, it
+// runs only when nothing else can and halts the CPU until the next
+// interrupt, which with a tickless timer may be several ticks away.
+// 'background' (klog flushing) runs before every sleep. Never returns
+void run_idle_task(void (*background)(void)) {
+    u32 flags = irq_save();
+    idle_process = current_process;
+    set_level(idle_process, SCHED_LEVELS - 1);
+    irq_restore(flags);
+    
+    while (1) {
+        if (background) background();
+        
+        asm volatile("cli");
+        if (ready_levels) {
+            // schedule() traps with int, interrupts may stay off
+            schedule();
+            asm volatile("sti");
+            continue;
+        }
+        timer_enter_idle();
+        // sti only takes effect after hlt starts: an interrupt in
+        // between still wakes us
+        asm volatile("sti; hlt; cli");
+        timer_exit_idle();
+        asm volatile("sti");
+    }
 }
 
 // Get current process PID
@@ -114,49 +477,155 @@ int get_current_pid(void) {
     return current_process ? current_process->pid : -1;
 }
 
-// Get process by PID
+// Get process by PID. Stale PIDs of reaped processes give NULL
 process_t *get_process(int pid) {
-    if (pid < 0 || pid >= MAX_PROCESSES) {
+    if (pid < 0 || (u32)PID_SLOT(pid) >= table_capacity) {
         return NULL;
     }
-    return &processes[pid];
+    process_t *proc = process_table[PID_SLOT(pid)].proc;
+    return (proc && proc->pid == pid) ? proc : NULL;
+}
+
+// Walk the process table: returns the next process at or after slot
+// '*cursor' and moves the cursor past it, NULL at the end
+process_t *next_process(u32 *cursor) {
+    while (*cursor < table_capacity) {
+        process_t *proc = process_table[(*cursor)++].proc;
+        if (proc) {
+            return proc;
+        }
+    }
+    return NULL;
+}
+
+// Everything a terminated process holds apart from its slot, PID and stack
+static void release_process_resources(process_t *proc) {
+    int pid = proc->pid;
+    
+    // Queues and zero-copy buffers first: buffers live in IPC regions
+    ipc_cleanup_process(pid);
+    syscall_ring_release(proc);
+    
+    // Free process memory regions
+    free_process_regions(pid);
+    
+    // Return the heap (kernel processes) or the whole address space
+    if (proc->page_directory == kernel_directory) {
+        kfree((u32)proc->heap);
+    } else {
+        paging_destroy_directory(proc->page_directory);
+    }
+    proc->heap = NULL;
+    proc->page_directory = NULL;
+    
+    kprint("Process terminated PID: ");
+    char pid_str[10];
+    int_to_ascii(pid, pid_str);
+    kprint(pid_str);
+    kprint(" (memory freed)\n");
 }
 
 // Terminate a process
 void terminate_process(int pid) {
     process_t *proc = get_process(pid);
-    if (proc) {
-        proc->state = PROCESS_TERMINATED;
-        
-        // Free process memory regions
-        for (int i = 0; i < region_count; i++) {
-            if (memory_regions[i].active && memory_regions[i].process_id == pid) {
-                free_memory_region(i);
-            }
-        }
-        
-        kprint("Process terminated PID: ");
-        char pid_str[10];
-        int_to_ascii(pid, pid_str);
-        kprint(pid_str);
-        kprint(" (memory freed)\n");
+    if (!proc || pid == 0) return;
+    
+    u32 flags = irq_save();
+    if (proc->state == PROCESS_TERMINATED) {
+        irq_restore(flags);
+        return;
+    }
+    if (proc->state == PROCESS_READY) {
+        ready_remove(proc);
+    }
+    proc->state = PROCESS_TERMINATED;
+    
+    // Another process goes at once; its cleanup can be preempted since
+    // the scheduler no longer sees it
+    if (proc != current_process) {
+        irq_restore(flags);
+        release_process_resources(proc);
+        flags = irq_save();
+        reap_process(proc);
+        irq_restore(flags);
+        return;
     }
+    
+    // The caller itself: once TERMINATED the scheduler never resumes it,
+    // so a preemption before the zombie link would leak everything it
+    // holds. Interrupts stay off until it is queued; the slot, PID and
+    // stack go once the CPU has left it
+    release_process_resources(proc);
+    proc->next_ready = zombies;
+    zombies = proc;
+    irq_restore(flags);
 }
 
 // Block a process
 void block_process(int pid) {
     process_t *proc = get_process(pid);
     if (proc) {
+        u32 flags = irq_save();
+        if (proc->state == PROCESS_READY) {
+            ready_remove(proc);
+        }
         proc->state = PROCESS_BLOCKED;
+        irq_restore(flags);
     }
 }
 
-// Unblock a process
+// Unblock a process. If it outranks the running one it gets the CPU at
+// the next interrupt exit rather than when the slice ends
 void unblock_process(int pid) {
     process_t *proc = get_process(pid);
-    if (proc) {
-        proc->state = PROCESS_READY;
+    if (!proc) return;
+    
+    u32 flags = irq_save();
+    if (proc->state == PROCESS_BLOCKED) {
+        if (proc == current_process) {
+            // Never switched out: still halting in wait_until_unblocked()
+            proc->state = PROCESS_RUNNING;
+        } else {
+            proc->state = PROCESS_READY;
+            ready_push(proc);
+            if (!current_process || current_process == idle_process ||
+                proc->level <= current_process->level) {
+                need_resched = 1;
+            }
+        }
+    }
+    irq_restore(flags);
+}
+
+// Raise a process to 'level' (if it is lower) with a fresh slice. Used
+// for IPC wakeups, so servers answer quickly even after burning CPU
+void boost_process(int pid, int level) {
+    process_t *proc = get_process(pid);
+    if (!proc || level < 0 || level >= proc->level) return;
+    
+    u32 flags = irq_save();
+    if (proc->state == PROCESS_READY) {
+        ready_remove(proc);
+        set_level(proc, level);
+        ready_push(proc);
+    } else {
+        set_level(proc, level);
+    }
+    irq_restore(flags);
+}
+
+// Sleep until the current process is unblocked. Other processes run in
+// the meantime; when none can, the CPU idles until an interrupt wakes
+// somebody up
+void wait_until_unblocked(void) {
+    u32 flags = irq_save();
+    while (current_process && current_process->state == PROCESS_BLOCKED) {
+        schedule();
+        if (current_process->state == PROCESS_BLOCKED) {
+            asm volatile("sti; hlt; cli");
+        }
     }
+    irq_restore(flags);
 }
 
 // Print all active processes
@@ -164,8 +633,9 @@ void print_all_processes(void) {
     kprint("=== Active Processes ===\n");
     
     int active_count = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t *proc = &processes[i];
+    u32 cursor = 0;
+    process_t *proc;
+    while ((proc = next_process(&cursor))) {
         if (proc->state != PROCESS_TERMINATED) {
             active_count++;
             
@@ -199,6 +669,10 @@ void print_all_processes(void) {
             } else {
                 kprint("USER");
             }
+            kprint(", level ");
+            char level_str[4];
+            int_to_ascii(proc->level, level_str);
+            kprint(level_str);
             kprint(")\n");
         }
     }
@@ -214,4 +688,104 @@ void print_all_processes(void) {
     }
     
     kprint("=====================\n");
-} 
\ No newline at end of file
+} 
+
+// Right-align 'value' in a column of 'width' characters
+static void print_column(u32 value, int width) {
+    char num_str[12];
+    int_to_ascii(value, num_str);
+    for (int pad = width - strlen(num_str); pad > 0; pad--) {
+        kprint(" ");
+    }
+    kprint(num_str);
+}
+
+static u32 ns_to_ms(u64 ns) {
+    return (u32)div_u64(ns, NSEC_PER_MSEC, NULL);
+}
+
+static u32 percent_of(u64 part, u64 whole) {
+    // Scale both down until the divisor fits 32 bits
+    while (whole >> 32) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    return whole ? (u32)div_u64(part * 100, (u32)whole, NULL) : 0;
+}
+
+// Busiest processes since the previous TOP (or since boot), with their
+// lifetime counters
+void print_process_top(void) {
+    static u64 last_top_ns = 0;
+    u32 flags = irq_save();
+    account_running();
+    u64 now = ktime_ns();
+    irq_restore(flags);
+    u64 interval = now - last_top_ns;
+    last_top_ns = now;
+    
+    // Insertion sort on the CPU time since the last sample, keeping the
+    // TOP_MAX_ROWS busiest
+    process_t *rows[TOP_MAX_ROWS];
+    int count = 0;
+    u32 cursor = 0;
+    process_t *proc;
+    while ((proc = next_process(&cursor))) {
+        if (proc->state == PROCESS_TERMINATED) continue;
+        u64 recent = proc->stats.run_ns - proc->stats.top_run_ns;
+        int i = (count < TOP_MAX_ROWS) ? count++ : TOP_MAX_ROWS;
+        while (i > 0 && recent > rows[i - 1]->stats.run_ns - rows[i - 1]->stats.top_run_ns) {
+            if (i < TOP_MAX_ROWS) rows[i] = rows[i - 1];
+            i--;
+        }
+        if (i < TOP_MAX_ROWS) rows[i] = proc;
+    }
+    
+    kprint("=== TOP: last ");
+    char num_str[12];
+    int_to_ascii(ns_to_ms(interval), num_str);
+    kprint(num_str);
+    kprint(" ms ===\n");
+    if (idle_process) {
+        u64 idle = idle_process->stats.run_ns - idle_process->stats.top_run_ns;
+        kprint("Idle: ");
+        int_to_ascii(percent_of(idle, interval), num_str);
+        kprint(num_str);
+        kprint("%, ");
+        int_to_ascii(timer_ticks_skipped(), num_str);
+        kprint(num_str);
+        kprint(" ticks slept through without a timer interrupt\n");
+    }
+    kprint("     PID ST LV CPU%  RUN_MS  SWITCH     VOL   INVOL IPCW_MS\n");
+    
+    for (int i = 0; i < count; i++) {
+        process_stats_t *stats = &rows[i]->stats;
+        
+        print_column(rows[i]->pid, 8);
+        if (rows[i] == idle_process) {
+            kprint("  I");
+        } else {
+            switch (rows[i]->state) {
+                case PROCESS_RUNNING: kprint("  R"); break;
+                case PROCESS_READY:   kprint("  r"); break;
+                case PROCESS_BLOCKED: kprint("  B"); break;
+                default:              kprint("  ?"); break;
+            }
+        }
+        print_column(rows[i]->level, 3);
+        print_column(percent_of(stats->run_ns - stats->top_run_ns, interval), 5);
+        print_column(ns_to_ms(stats->run_ns), 8);
+        print_column(stats->switches, 8);
+        print_column(stats->voluntary, 8);
+        print_column(stats->involuntary, 8);
+        print_column(ns_to_ms(stats->ipc_wait_ns), 8);
+        kprint("\n");
+    }
+    
+    // The next TOP reports usage from here on
+    cursor = 0;
+    while ((proc = next_process(&cursor))) {
+        proc->stats.top_run_ns = proc->stats.run_ns;
+    }
+    kprint("R running, r ready, B blocked, I idle task\n");
+}
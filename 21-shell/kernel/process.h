@@ -13,41 +13,88 @@
 #define PRIVILEGE_KERNEL 0
 #define PRIVILEGE_USER   1
 
-// Maximum processes
-#define MAX_PROCESSES 16
+// Process table. It starts small and doubles on demand; a PID is the
+// table slot in its low bits plus the slot's generation above them, so a
+// recycled slot never answers to the PID of its previous owner
+#define PROCESS_TABLE_INITIAL 16
+#define PID_SLOT_BITS         10
+#define PROCESS_TABLE_LIMIT   (1 << PID_SLOT_BITS)
+#define PID_SLOT(pid)         ((pid) & (PROCESS_TABLE_LIMIT - 1))
 
-// Process structure
+// Every process runs on a kernel stack of this size. Kernel threads run
+// whole shell commands, with their nested kprint/klog calls, so they get
+// more
+#define PROCESS_STACK_SIZE       0x1000
+#define KERNEL_THREAD_STACK_SIZE 0x4000
+
+// Multilevel feedback queue: level 0 runs first. A process that uses up
+// its slice drops a level, where slices are twice as long; IPC wakeups
+// lift it again and every SCHED_BOOST_TICKS all processes go back to the
+// top, so CPU-bound work cannot be starved for good
+#define SCHED_LEVELS 4
+#define SCHED_SLICE_TICKS(level) (1u << (level))
+#define SCHED_BOOST_TICKS 50
+
+// CPU accounting. Times come from the clocksource (ktime_ns); ticks
+// are what time slices are measured in
 typedef struct {
+    u32 ticks;            // Timer ticks that found the process running
+    u32 switches;         // Times it was switched out...
+    u32 voluntary;        // ...because it blocked, yielded or exited
+    u32 involuntary;      // ...because it was preempted
+    u64 run_ns;           // Time on the CPU
+    u64 ipc_wait_ns;      // Time spent blocked in IPC receive
+    u64 top_run_ns;       // 'run_ns' at the previous TOP
+} process_stats_t;
+
+// Rows shown by TOP, busiest first
+#define TOP_MAX_ROWS 16
+
+// Process structure
+typedef struct process {
     int pid;
-    void *stack;
+    void *stack;      // Kernel stack the process runs on
+    int owns_stack;   // Stack was allocated by create_process, freed with it
+    u32 stack_size;   // Bytes at 'stack'
     void *heap;
     int privileges;
     int state;
-    struct {
-        u32 eax, ebx, ecx, edx;
-        u32 esi, edi, ebp, esp;
-        u32 eip, eflags;
-        u32 cs, ds, es, fs, gs, ss;
-    } regs;
-    int code_segment;
+    u32 context;          // Saved esp: its registers_t frame while switched out
+    u8 *fpu_state;        // FXSAVE area, allocated on first FPU use
+    int level;            // Scheduler level, 0 = highest
+    u32 slice_left;       // Ticks left of the current time slice
+    struct process *next_ready;  // Ready list of 'level' (READY only)
+    struct process *prev_ready;
+    process_stats_t stats;
+    int code_segment;     // Private GDT selectors, 0 when none were free
     int data_segment;
+    u32 *page_directory;  // Address space (kernel_directory for kernel processes)
+    struct syscall_ring *syscall_ring;  // Batched system calls, NULL until set up
 } process_t;
 
 // Process management
 extern process_t *current_process;
-extern process_t processes[MAX_PROCESSES];
-extern int next_pid;
 
 // Function declarations
+// 'stack' may be NULL: the process then gets a kernel stack of its own
 process_t *create_process(void (*entry_point)(void), void *stack, int privileges);
+process_t *create_kernel_thread(void (*entry)(void *arg), void *arg);
 void init_process_manager(void);
+void start_scheduler(void);
+void run_idle_task(void (*background)(void));
 void schedule(void);
-void switch_to_process(process_t *proc);
+void scheduler_tick(u32 ticks);
+u32 schedule_from_irq(u32 esp);
+u32 switch_to_process(process_t *proc, u32 esp);
 int get_current_pid(void);
 process_t *get_process(int pid);
+process_t *next_process(u32 *cursor);
 void terminate_process(int pid);
 void block_process(int pid);
 void unblock_process(int pid);
+void boost_process(int pid, int level);
+void wait_until_unblocked(void);
 void print_all_processes(void);
+void print_process_top(void);
 
 #endif // PROCESS_H 
\ No newline at end of file
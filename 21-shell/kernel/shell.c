@@ -0,0 +1,154 @@
+#include "shell.h"
+#include "kernel.h"
+#include "process.h"
+#include "../drivers/keyboard.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/function.h"
+
+#define CTRL_U 0x15
+
+static line_editor_t line;
+
+// Ring of finished lines, newest at history_count - 1
+static char history[SHELL_HISTORY][SHELL_LINE_MAX + 1];
+static u32 history_count = 0;
+static u32 history_back = 0;                 // Lines back while browsing, 0: the draft
+static char draft[SHELL_LINE_MAX + 1];       // What was typed before browsing
+
+// Echo text[from..len) from the cursor, blank 'erase' cells left over
+// from a longer line, then put the cursor back at 'pos'
+static void redraw_tail(line_editor_t *ed, u32 from, u32 erase) {
+    ed->text[ed->len] = '\0';
+    kprint(ed->text + from);
+    for (u32 i = 0; i < erase; i++) {
+        kprint(" ");
+    }
+    kprint_move_cursor(-(int)(ed->len + erase - ed->pos));
+}
+
+// Replace the whole line, cursor at its end
+static void set_line(line_editor_t *ed, char *text) {
+    u32 old_len = ed->len;
+    kprint_move_cursor(-(int)ed->pos);
+
+    u32 len = strlen(text);
+    memory_copy((u8*)text, (u8*)ed->text, len);
+    ed->len = len;
+    ed->pos = len;
+    redraw_tail(ed, 0, old_len > len ? old_len - len : 0);
+}
+
+static void insert_char(line_editor_t *ed, char c) {
+    if (ed->len == SHELL_LINE_MAX) return;
+    for (u32 i = ed->len; i > ed->pos; i--) {
+        ed->text[i] = ed->text[i - 1];
+    }
+    ed->text[ed->pos++] = c;
+    ed->len++;
+    redraw_tail(ed, ed->pos - 1, 0);
+}
+
+// Remove the character under the cursor
+static void delete_char(line_editor_t *ed) {
+    if (ed->pos == ed->len) return;
+    for (u32 i = ed->pos; i + 1 < ed->len; i++) {
+        ed->text[i] = ed->text[i + 1];
+    }
+    ed->len--;
+    redraw_tail(ed, ed->pos, 1);
+}
+
+static void move_to(line_editor_t *ed, u32 pos) {
+    kprint_move_cursor((int)pos - (int)ed->pos);
+    ed->pos = pos;
+}
+
+// Lines back from the newest, 1 being the newest; 0 past what is kept
+static char *history_line(u32 back) {
+    if (back == 0 || back > history_count || back > SHELL_HISTORY) return 0;
+    return history[(history_count - back) % SHELL_HISTORY];
+}
+
+static void history_add(line_editor_t *ed) {
+    char *newest = history_line(1);
+    if (ed->len == 0 || (newest && strcmp(newest, ed->text) == 0)) return;
+    memory_copy((u8*)ed->text, (u8*)history[history_count % SHELL_HISTORY], ed->len + 1);
+    history_count++;
+}
+
+static void history_up(line_editor_t *ed) {
+    char *older = history_line(history_back + 1);
+    if (!older) return;
+    if (history_back == 0) {
+        ed->text[ed->len] = '\0';
+        memory_copy((u8*)ed->text, (u8*)draft, ed->len + 1);
+    }
+    history_back++;
+    set_line(ed, older);
+}
+
+static void history_down(line_editor_t *ed) {
+    if (history_back == 0) return;
+    history_back--;
+    set_line(ed, history_back ? history_line(history_back) : draft);
+}
+
+// Apply one key press to the line. Returns 1 once the line is complete
+static int line_edit(line_editor_t *ed, key_event_t *key) {
+    if (!(key->flags & KEY_EVENT_PRESSED)) return 0;
+
+    switch (key->keycode) {
+        case KEY_ENTER:
+        case KEY_KP_ENTER:
+            move_to(ed, ed->len);
+            ed->text[ed->len] = '\0';
+            kprint("\n");
+            return 1;
+        case KEY_BACKSPACE:
+            // Never past the start of the line, the prompt stays put
+            if (ed->pos > 0) {
+                move_to(ed, ed->pos - 1);
+                delete_char(ed);
+            }
+            return 0;
+        case KEY_DELETE: delete_char(ed); return 0;
+        case KEY_LEFT:   if (ed->pos > 0) move_to(ed, ed->pos - 1); return 0;
+        case KEY_RIGHT:  if (ed->pos < ed->len) move_to(ed, ed->pos + 1); return 0;
+        case KEY_HOME:   move_to(ed, 0); return 0;
+        case KEY_END:    move_to(ed, ed->len); return 0;
+        case KEY_UP:     history_up(ed); return 0;
+        case KEY_DOWN:   history_down(ed); return 0;
+    }
+
+    if (key->ascii == CTRL_U) {
+        set_line(ed, "");
+    } else if ((u8)key->ascii >= ' ' && key->ascii != 0x7F) {
+        insert_char(ed, key->ascii);
+    }
+    return 0;
+}
+
+static void shell_thread(void *arg) {
+    UNUSED(arg);
+    key_event_t key;
+    while (1) {
+        keyboard_read_event(&key);
+        if (line_edit(&line, &key)) {
+            history_add(&line);
+            history_back = 0;
+            user_input(line.text);
+            line.len = 0;
+            line.pos = 0;
+        }
+    }
+}
+
+void init_shell(void) {
+    line.len = 0;
+    line.pos = 0;
+    if (!create_kernel_thread(shell_thread, 0)) {
+        kprint("Shell: could not start the shell thread\n");
+    }
+}
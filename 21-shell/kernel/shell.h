@@ -0,0 +1,22 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include "../cpu/types.h"
+
+// The shell runs in its own kernel thread: the keyboard IRQ only decodes
+// keys, and commands run with interrupts on, however long they take
+#define SHELL_LINE_MAX 255
+#define SHELL_HISTORY  16   // Lines Up/Down can bring back
+
+// Line being typed. 'len' is kept alongside the text, so editing never
+// scans it and a full line refuses keys instead of overflowing; 'pos'
+// is the cursor, 0..len
+typedef struct {
+    char text[SHELL_LINE_MAX + 1];
+    u32 len;
+    u32 pos;
+} line_editor_t;
+
+void init_shell(void);
+
+#endif
@@ -0,0 +1,122 @@
+#include "syscall_ring.h"
+#include "syscalls.h"
+#include "ipc.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+
+#define NULL ((void*)0)
+
+// Keep the compiler from moving ring accesses across index updates
+#define ring_barrier() asm volatile("" : : : "memory")
+
+// One allocation: header, submission entries, completion entries
+syscall_ring_t *syscall_ring_setup(process_t *proc, u32 entries) {
+    if (entries == 0 || entries > SYSCALL_RING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return NULL;
+    }
+    if (proc->syscall_ring) {
+        return proc->syscall_ring->entries == entries ? proc->syscall_ring : NULL;
+    }
+    
+    u32 size = sizeof(syscall_ring_t) + entries * (sizeof(syscall_sqe_t) + sizeof(syscall_cqe_t));
+    syscall_ring_t *ring = (syscall_ring_t*)kmalloc(size, 0, NULL);
+    if (!ring) {
+        return NULL;
+    }
+    memset(ring, 0, size);
+    ring->entries = entries;
+    ring->sqes = (syscall_sqe_t*)(ring + 1);
+    ring->cqes = (syscall_cqe_t*)(ring->sqes + entries);
+    proc->syscall_ring = ring;
+    return ring;
+}
+
+void syscall_ring_release(process_t *proc) {
+    if (proc->syscall_ring) {
+        kfree((u32)proc->syscall_ring);
+        proc->syscall_ring = NULL;
+    }
+}
+
+// Run one operation exactly as its system call would, except that a
+// receive never blocks the batch: an empty queue completes with 0
+static u32 ring_execute(syscall_sqe_t *sqe) {
+    switch (sqe->opcode) {
+        case SYS_IPC_SEND:
+        case SYS_IPC_SEND_PRIORITY:
+        case SYS_CALL_WRITE: {
+            registers_t regs;
+            memset(&regs, 0, sizeof(regs));
+            regs.eax = sqe->opcode;
+            regs.ebx = sqe->args[0];
+            regs.ecx = sqe->args[1];
+            regs.edx = sqe->args[2];
+            regs.esi = sqe->args[3];
+            regs.edi = sqe->args[4];
+            syscall_handler(&regs);
+            return regs.eax;
+        }
+        case SYS_IPC_RECEIVE:
+            return ipc_receive_with_timeout(get_current_pid(), (ipc_message_t*)sqe->args[0], 0);
+        default:
+            return SYSCALL_RING_ERROR;
+    }
+}
+
+// Consume up to 'max_submit' queued operations (0: all of them), as long
+// as there is room for their completions. Returns how many ran
+u32 syscall_ring_enter(process_t *proc, u32 max_submit) {
+    syscall_ring_t *ring = proc->syscall_ring;
+    if (!ring) {
+        return 0;
+    }
+    
+    u32 mask = ring->entries - 1;
+    u32 done = 0;
+    while (ring->sq_head != ring->sq_tail && (!max_submit || done < max_submit)) {
+        if (ring->cq_tail - ring->cq_head == ring->entries) {
+            ring->cq_overflow++;
+            break;
+        }
+        ring_barrier();
+        
+        // Copy the entry first: the process may reuse the slot as soon
+        // as sq_head moves
+        syscall_sqe_t sqe = ring->sqes[ring->sq_head & mask];
+        ring_barrier();
+        ring->sq_head++;
+        
+        syscall_cqe_t *cqe = &ring->cqes[ring->cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->result = ring_execute(&sqe);
+        ring_barrier();
+        ring->cq_tail++;
+        done++;
+    }
+    return done;
+}
+
+syscall_sqe_t *syscall_ring_get_sqe(syscall_ring_t *ring) {
+    if (ring->sq_tail - ring->sq_head == ring->entries) {
+        return NULL;
+    }
+    syscall_sqe_t *sqe = &ring->sqes[ring->sq_tail & (ring->entries - 1)];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void syscall_ring_submit(syscall_ring_t *ring) {
+    ring_barrier();
+    ring->sq_tail++;
+}
+
+int syscall_ring_complete(syscall_ring_t *ring, syscall_cqe_t *cqe) {
+    if (ring->cq_head == ring->cq_tail) {
+        return 0;
+    }
+    ring_barrier();
+    *cqe = ring->cqes[ring->cq_head & (ring->entries - 1)];
+    ring_barrier();
+    ring->cq_head++;
+    return 1;
+}
@@ -0,0 +1,48 @@
+#ifndef SYSCALL_RING_H
+#define SYSCALL_RING_H
+
+#include "../cpu/types.h"
+#include "process.h"
+
+// Batched system calls. A process queues operations in the submission
+// ring and runs the whole batch with one SYS_RING_ENTER; every operation
+// leaves a completion with its result. Only the process writes sq_tail
+// and cq_head, only the kernel writes sq_head and cq_tail
+#define SYSCALL_RING_MAX_ENTRIES 256  // Power of two
+#define SYSCALL_RING_ERROR 0xFFFFFFFF  // Result of an unsupported opcode
+
+typedef struct {
+    u32 opcode;      // SYS_IPC_SEND, SYS_IPC_SEND_PRIORITY, SYS_IPC_RECEIVE or SYS_CALL_WRITE
+    u32 args[5];     // ebx, ecx, edx, esi, edi of the plain system call
+    u32 user_data;   // Handed back in the completion
+} syscall_sqe_t;
+
+typedef struct {
+    u32 user_data;
+    u32 result;      // What the plain system call returns in eax
+} syscall_cqe_t;
+
+typedef struct syscall_ring {
+    volatile u32 sq_head;
+    volatile u32 sq_tail;
+    volatile u32 cq_head;
+    volatile u32 cq_tail;
+    u32 entries;
+    u32 cq_overflow;      // Batches cut short because the CQ was full
+    syscall_sqe_t *sqes;
+    syscall_cqe_t *cqes;
+} syscall_ring_t;
+
+// Kernel side: SYS_RING_SETUP and SYS_RING_ENTER
+syscall_ring_t *syscall_ring_setup(process_t *proc, u32 entries);
+u32 syscall_ring_enter(process_t *proc, u32 max_submit);
+void syscall_ring_release(process_t *proc);
+
+// Process side: fill the entry syscall_ring_get_sqe() hands out (NULL
+// when the ring is full), then publish it with syscall_ring_submit().
+// syscall_ring_complete() takes the oldest completion, 0 if none
+syscall_sqe_t *syscall_ring_get_sqe(syscall_ring_t *ring);
+void syscall_ring_submit(syscall_ring_t *ring);
+int syscall_ring_complete(syscall_ring_t *ring, syscall_cqe_t *cqe);
+
+#endif // SYSCALL_RING_H
@@ -4,17 +4,22 @@
 #include "process.h"
 #include "privilege.h"
 #include "ipc.h"
+#include "../libc/mem.h"
+#include "klog.h"
+#include "syscall_ring.h"
+#include "memory.h"
+#include "../cpu/gdt.h"
 
 #define NULL ((void*)0)
 
 // System call handler table
 typedef void (*syscall_handler_t)(registers_t *);
-syscall_handler_t syscall_handlers[30]; // Increased for enhanced IPC calls
+syscall_handler_t syscall_handlers[MAX_SYSCALLS];
 
 // Initialize system call interface
 void init_syscall_interface(void) {
     // Clear all handlers
-    for (int i = 0; i < 30; i++) {
+    for (int i = 0; i < MAX_SYSCALLS; i++) {
         syscall_handlers[i] = NULL;
     }
     
@@ -37,7 +42,19 @@ void init_syscall_interface(void) {
     register_syscall_handler(SYS_IPC_BROADCAST, syscall_ipc_broadcast);
     register_syscall_handler(SYS_IPC_GET_STATS, syscall_ipc_get_stats);
     
-    kprint("Enhanced system call interface initialized\n");
+    // Register zero-copy IPC handlers
+    register_syscall_handler(SYS_IPC_BUFFER_ALLOC, syscall_ipc_buffer_alloc);
+    register_syscall_handler(SYS_IPC_SEND_BUFFER, syscall_ipc_send_buffer);
+    register_syscall_handler(SYS_IPC_BUFFER_FREE, syscall_ipc_buffer_free);
+    
+    // Register batched submission handlers
+    register_syscall_handler(SYS_RING_SETUP, syscall_ring_setup_handler);
+    register_syscall_handler(SYS_RING_ENTER, syscall_ring_enter_handler);
+    
+    // Register diagnostics handlers
+    register_syscall_handler(SYS_IRQ_STATS, syscall_irq_stats);
+    
+    klog_info("System call interface initialized");
 }
 
 // Main system call handler
@@ -45,12 +62,8 @@ void syscall_handler(registers_t *regs) {
     u32 syscall_number = regs->eax;
     
     // Validate system call number
-    if (syscall_number >= 30 || syscall_handlers[syscall_number] == NULL) {
-        kprint("Invalid system call: ");
-        char num_str[10];
-        int_to_ascii(syscall_number, num_str);
-        kprint(num_str);
-        kprint("\n");
+    if (syscall_number >= MAX_SYSCALLS || syscall_handlers[syscall_number] == NULL) {
+        klog_warn("Invalid system call: %u", syscall_number);
         regs->eax = -1; // Return error
         return;
     }
@@ -61,7 +74,7 @@ void syscall_handler(registers_t *regs) {
 
 // Register a system call handler
 void register_syscall_handler(u32 syscall_number, void (*handler)(registers_t *)) {
-    if (syscall_number < 30) {
+    if (syscall_number < MAX_SYSCALLS) {
         syscall_handlers[syscall_number] = handler;
     }
 }
@@ -70,16 +83,14 @@ void register_syscall_handler(u32 syscall_number, void (*handler)(registers_t *)
 void syscall_exit(registers_t *regs) {
     u32 exit_code = regs->ebx;
     
-    kprint("Process exit with code: ");
-    char code_str[10];
-    int_to_ascii(exit_code, code_str);
-    kprint(code_str);
-    kprint("\n");
+    klog_info("Process exit with code: %u", exit_code);
     
     // Terminate current process
     int current_pid = get_current_pid();
     if (current_pid >= 0) {
         terminate_process(current_pid);
+        // Never returns for a terminated process: the scheduler drops it
+        schedule();
     }
     
     regs->eax = 0; // Success
@@ -173,27 +184,90 @@ void syscall_ipc_get_stats(registers_t *regs) {
     regs->eax = result;
 }
 
+// System call: IPC_BUFFER_ALLOC
+void syscall_ipc_buffer_alloc(registers_t *regs) {
+    u32 size = regs->ebx;
+    u32 addr_ptr = regs->ecx;
+    
+    u32 *addr = (u32*)addr_ptr;
+    
+    u32 result = sys_ipc_buffer_alloc(size, addr);
+    regs->eax = result;
+}
+
+// System call: IPC_SEND_BUFFER
+void syscall_ipc_send_buffer(registers_t *regs) {
+    u32 receiver_pid = regs->ebx;
+    u32 message_type = regs->ecx;
+    u32 handle = regs->edx;
+    u32 size = regs->esi;
+    u32 priority = regs->edi;
+    
+    u32 result = sys_ipc_send_buffer(receiver_pid, message_type, handle, size, priority);
+    regs->eax = result;
+}
+
+// System call: IPC_BUFFER_FREE
+void syscall_ipc_buffer_free(registers_t *regs) {
+    u32 handle = regs->ebx;
+    
+    u32 result = sys_ipc_buffer_free(handle);
+    regs->eax = result;
+}
+
+// System call: RING_SETUP
+void syscall_ring_setup_handler(registers_t *regs) {
+    u32 entries = regs->ebx;
+    
+    // Returns the ring's address, 0 if the size is not a power of two
+    // up to SYSCALL_RING_MAX_ENTRIES or memory ran out
+    process_t *proc = get_process(get_current_pid());
+    regs->eax = proc ? (u32)syscall_ring_setup(proc, entries) : 0;
+}
+
+// System call: RING_ENTER
+void syscall_ring_enter_handler(registers_t *regs) {
+    u32 max_submit = regs->ebx;
+    
+    // Returns the number of operations run
+    process_t *proc = get_process(get_current_pid());
+    regs->eax = proc ? syscall_ring_enter(proc, max_submit) : 0;
+}
+
+// System call: IRQ_STATS
+void syscall_irq_stats(registers_t *regs) {
+    u32 vector = regs->ebx;
+    u32 stats_ptr = regs->ecx;
+    
+    // Copies the counters and handler times of one vector; returns 0 if
+    // the vector never fired
+    if (vector > 255) {
+        regs->eax = 0;
+        return;
+    }
+    regs->eax = get_interrupt_stats((u8)vector, (interrupt_stats_t*)stats_ptr);
+}
+
 // System call: WRITE
 void syscall_write(registers_t *regs) {
     u32 fd = regs->ebx;
     u32 buf = regs->ecx;
     u32 count = regs->edx;
     
-    kprint("Write syscall: fd=");
-    char fd_str[10];
-    int_to_ascii(fd, fd_str);
-    kprint(fd_str);
-    kprint(", count=");
-    char count_str[10];
-    int_to_ascii(count, count_str);
-    kprint(count_str);
-    kprint("\n");
-    
-    // For now, just print the data
+    klog_debug("Write syscall: fd=%u, count=%u", fd, count);
+    
+    // For now, just print the data, a chunk per kprint
     char *data = (char*)buf;
-    for (u32 i = 0; i < count; i++) {
-        char str[2] = {data[i], '\0'};
-        kprint(str);
+    char chunk[65];
+    u32 done = 0;
+    while (done < count) {
+        u32 n = count - done < 64 ? count - done : 64;
+        for (u32 i = 0; i < n; i++) {
+            chunk[i] = data[done + i];
+        }
+        chunk[n] = '\0';
+        kprint(chunk);
+        done += n;
     }
     
     regs->eax = count; // Return number of bytes written
@@ -204,15 +278,7 @@ void syscall_read(registers_t *regs) {
     u32 fd = regs->ebx;
     u32 count = regs->edx;
     
-    kprint("Read syscall: fd=");
-    char fd_str[10];
-    int_to_ascii(fd, fd_str);
-    kprint(fd_str);
-    kprint(", count=");
-    char count_str[10];
-    int_to_ascii(count, count_str);
-    kprint(count_str);
-    kprint("\n");
+    klog_debug("Read syscall: fd=%u, count=%u", fd, count);
     
     // For now, return 0 (no data read)
     regs->eax = 0;
@@ -222,25 +288,38 @@ void syscall_read(registers_t *regs) {
 void syscall_alloc(registers_t *regs) {
     u32 size = regs->ebx;
     
-    kprint("Alloc syscall: size=");
-    char size_str[10];
-    int_to_ascii(size, size_str);
-    kprint(size_str);
-    kprint("\n");
+    klog_debug("Alloc syscall: size=%u", size);
     
-    // For now, return a dummy address
-    regs->eax = 0x1000000; // Return dummy address
+    // Returns 0 when the heap is exhausted. Every block is recorded as a
+    // region of the caller, so it goes with the process and only the
+    // caller can free it
+    u32 block = kmalloc(size, 0, NULL);
+    if (block && allocate_memory_region(block, size, PERMISSION_READ | PERMISSION_WRITE,
+                                        get_current_pid(), MEMORY_TYPE_ALLOC) == -1) {
+        kfree(block);
+        block = 0;
+    }
+    regs->eax = block;
 }
 
 // System call: FREE
 void syscall_free(registers_t *regs) {
     u32 ptr = regs->ebx;
     
-    kprint("Free syscall: ptr=");
-    char ptr_str[10];
-    int_to_ascii(ptr, ptr_str);
-    kprint(ptr_str);
-    kprint("\n");
-    
+    klog_debug("Free syscall: ptr=%x", ptr);
+    
+    // Only the start of a block the caller got from ALLOC and has not
+    // freed yet; anything else would hand kfree() a foreign pointer
+    u32 flags = irq_save();
+    int region_id = find_memory_region(ptr, get_current_pid());
+    if (region_id == -1 || memory_regions[region_id].type != MEMORY_TYPE_ALLOC ||
+        memory_regions[region_id].start != ptr) {
+        irq_restore(flags);
+        klog_warn("Free syscall: %x is not a block of PID %d", ptr, get_current_pid());
+        regs->eax = (u32)-1;
+        return;
+    }
+    free_memory_region(region_id);
+    irq_restore(flags);
     regs->eax = 0; // Success
 } 
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 // System call interface
 #define SYSCALL_INTERRUPT 0x80
+#define MAX_SYSCALLS      64
 
 // System call numbers (matching privilege.h)
 #define SYS_CALL_EXIT     1
@@ -25,6 +26,19 @@
 #define SYS_IPC_RECEIVE_TIMEOUT 25
 #define SYS_IPC_BROADCAST 26
 #define SYS_IPC_GET_STATS 27
+#define SYS_IPC_BUFFER_ALLOC 28
+#define SYS_IPC_SEND_BUFFER 29
+#define SYS_IPC_BUFFER_FREE 30
+
+// Batched system calls (syscall_ring.h)
+#define SYS_RING_SETUP      40
+#define SYS_RING_ENTER      41
+
+// Diagnostics
+#define SYS_IRQ_STATS       42
+
+// Entry point (cpu/isr_stubs_simple.asm). 'int 0x80' works from any ring
+extern void syscall_stub();
 
 // System call function declarations
 void init_syscall_interface(void);
@@ -47,5 +61,15 @@ void syscall_ipc_send_priority(registers_t *regs);
 void syscall_ipc_receive_timeout(registers_t *regs);
 void syscall_ipc_broadcast(registers_t *regs);
 void syscall_ipc_get_stats(registers_t *regs);
+void syscall_ipc_buffer_alloc(registers_t *regs);
+void syscall_ipc_send_buffer(registers_t *regs);
+void syscall_ipc_buffer_free(registers_t *regs);
+
+// Submission ring handlers
+void syscall_ring_setup_handler(registers_t *regs);
+void syscall_ring_enter_handler(registers_t *regs);
+
+// Diagnostics handlers
+void syscall_irq_stats(registers_t *regs);
 
 #endif // SYSCALLS_H 
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "mem.h"
 #include "function.h"
+#include "../kernel/pmm.h"
+#include "../cpu/isr.h"
 
 void memory_copy(u8 *source, u8 *dest, int nbytes) {
     int i;
@@ -13,29 +15,244 @@ void memory_set(u8 *dest, u8 val, u32 len) {
     for ( ; len != 0; len--) *temp++ = val;
 }
 
-/* This should be computed at link time, but a lot of newer systems
- * don't have a working "free" -- not even the kernel. We'll use
- * this as a simple (and non-unique) solution. */
-u32 free_mem_addr = 0x30000;  /* Start after kernel regions */
+/**********************************************************
+ * Kernel heap: size-class slabs + page spans             *
+ **********************************************************/
+
+/* Every heap page has a descriptor that lives outside the page itself,
+ * so kfree() finds the owner of any pointer with a single subtraction
+ * and slab objects can start right at the page boundary. */
+#define PAGE_FREE      0
+#define PAGE_SLAB      1
+#define PAGE_SPAN      2   /* First page of a multi-page block */
+#define PAGE_SPAN_TAIL 3   /* Any other page of that block */
+
+#define NO_PAGE 0xFFFF
+
+typedef struct {
+    u8  kind;
+    u8  size_class;
+    u16 inuse;       /* Slab: objects handed out */
+    u16 next;        /* Slab: neighbours in the class' partial list */
+    u16 prev;
+    u32 freelist;    /* Slab: first free object, 0 when the slab is full */
+    u32 span_pages;  /* Span head: length of the block in pages */
+} heap_page_t;
+
+static heap_page_t *heap_pages = 0;
+static u32 heap_base = 0;
+static u32 heap_npages = 0;
+static u32 heap_free_pages = 0;
+static u32 heap_search_hint = 0;   /* No free page below this index */
+
+/* Slabs with at least one free object, per size class */
+static u16 partial_slabs[KMALLOC_NUM_CLASSES];
+static u32 class_slabs[KMALLOC_NUM_CLASSES];
+static u32 class_live[KMALLOC_NUM_CLASSES];
 
 /* Memory statistics tracking */
 static u32 total_allocated = 0;
 static u32 allocation_count = 0;
+static u32 free_count = 0;
 static u32 max_allocation = 0;
+static u32 live_bytes = 0;
+
+#define CLASS_SIZE(c) ((u32)KMALLOC_MIN_SIZE << (c))
+#define PAGE_ADDR(i)  (heap_base + (u32)(i) * KHEAP_PAGE_SIZE)
+
+/* Smallest class whose objects fit 'size'. bsr keeps this branch-free */
+static int size_to_class(u32 size) {
+    if (size <= KMALLOC_MIN_SIZE) return 0;
+    return (32 - __builtin_clz(size - 1)) - 4;
+}
+
+void init_kernel_heap(void) {
+    /* One contiguous run of frames: descriptor table first, then the
+     * arena. Settle for less when memory is tight or fragmented */
+    u32 pages = KHEAP_MAX_PAGES;
+    u32 table_frames = 0;
+    u32 base = 0;
+    while (pages >= KHEAP_MIN_PAGES) {
+        table_frames = (pages * sizeof(heap_page_t) + KHEAP_PAGE_SIZE - 1) / KHEAP_PAGE_SIZE;
+        base = pmm_alloc_frames(table_frames + pages);
+        if (base) break;
+        pages /= 2;
+    }
+    if (!base) pages = 0;
+
+    heap_pages = (heap_page_t*)base;
+    heap_base = base + table_frames * KHEAP_PAGE_SIZE;
+    heap_npages = pages;
+
+    for (u32 i = 0; i < heap_npages; i++) {
+        heap_pages[i].kind = PAGE_FREE;
+        heap_pages[i].next = NO_PAGE;
+        heap_pages[i].prev = NO_PAGE;
+        heap_pages[i].inuse = 0;
+        heap_pages[i].freelist = 0;
+        heap_pages[i].span_pages = 0;
+    }
+    heap_free_pages = heap_npages;
+    heap_search_hint = 0;
+
+    for (int c = 0; c < KMALLOC_NUM_CLASSES; c++) {
+        partial_slabs[c] = NO_PAGE;
+        class_slabs[c] = 0;
+        class_live[c] = 0;
+    }
+    live_bytes = 0;
+    reset_memory_stats();
+}
+
+/* First-fit search for 'count' contiguous free pages. Only runs when a
+ * class needs a fresh slab or for large blocks, so small allocations
+ * stay O(1) amortised. Returns the first page index or NO_PAGE */
+static u32 heap_alloc_pages(u32 count) {
+    if (count == 0 || count > heap_free_pages) return NO_PAGE;
+
+    u32 run = 0;
+    for (u32 i = heap_search_hint; i < heap_npages; i++) {
+        if (heap_pages[i].kind != PAGE_FREE) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            u32 first = i + 1 - count;
+            heap_pages[first].kind = PAGE_SPAN;
+            heap_pages[first].span_pages = count;
+            for (u32 j = first + 1; j <= i; j++) {
+                heap_pages[j].kind = PAGE_SPAN_TAIL;
+            }
+            heap_free_pages -= count;
+            if (first == heap_search_hint) heap_search_hint = i + 1;
+            return first;
+        }
+    }
+    return NO_PAGE;
+}
+
+static void heap_release_pages(u32 first, u32 count) {
+    for (u32 j = first; j < first + count; j++) {
+        heap_pages[j].kind = PAGE_FREE;
+        heap_pages[j].span_pages = 0;
+    }
+    heap_free_pages += count;
+    if (first < heap_search_hint) heap_search_hint = first;
+}
+
+static void partial_push(int c, u32 idx) {
+    heap_page_t *pg = &heap_pages[idx];
+    pg->prev = NO_PAGE;
+    pg->next = partial_slabs[c];
+    if (pg->next != NO_PAGE) heap_pages[pg->next].prev = idx;
+    partial_slabs[c] = idx;
+}
+
+static void partial_unlink(int c, u32 idx) {
+    heap_page_t *pg = &heap_pages[idx];
+    if (pg->prev != NO_PAGE) heap_pages[pg->prev].next = pg->next;
+    else partial_slabs[c] = pg->next;
+    if (pg->next != NO_PAGE) heap_pages[pg->next].prev = pg->prev;
+    pg->next = NO_PAGE;
+    pg->prev = NO_PAGE;
+}
+
+/* Carve a fresh page into objects of class 'c' and thread the free list
+ * through the objects themselves */
+static u32 slab_create(int c) {
+    u32 idx = heap_alloc_pages(1);
+    if (idx == NO_PAGE) return NO_PAGE;
+
+    heap_page_t *pg = &heap_pages[idx];
+    u32 obj_size = CLASS_SIZE(c);
+    u32 base = PAGE_ADDR(idx);
+    u32 count = KHEAP_PAGE_SIZE / obj_size;
+
+    for (u32 i = 0; i < count - 1; i++) {
+        *(u32*)(base + i * obj_size) = base + (i + 1) * obj_size;
+    }
+    *(u32*)(base + (count - 1) * obj_size) = 0;
+
+    pg->kind = PAGE_SLAB;
+    pg->size_class = c;
+    pg->inuse = 0;
+    pg->freelist = base;
+    pg->span_pages = 0;
+    partial_push(c, idx);
+    class_slabs[c]++;
+    return idx;
+}
+
+static u32 slab_alloc(int c) {
+    u32 idx = partial_slabs[c];
+    if (idx == NO_PAGE) {
+        idx = slab_create(c);
+        if (idx == NO_PAGE) return 0;
+    }
+
+    heap_page_t *pg = &heap_pages[idx];
+    u32 obj = pg->freelist;
+    pg->freelist = *(u32*)obj;
+    pg->inuse++;
+    if (pg->freelist == 0) partial_unlink(c, idx);
+
+    class_live[c]++;
+    live_bytes += CLASS_SIZE(c);
+    return obj;
+}
+
+static void slab_free(u32 idx, u32 addr) {
+    heap_page_t *pg = &heap_pages[idx];
+    int c = pg->size_class;
+
+    /* Reject pointers into the middle of an object */
+    if ((addr - PAGE_ADDR(idx)) & (CLASS_SIZE(c) - 1)) return;
+
+    int was_full = (pg->freelist == 0);
+    *(u32*)addr = pg->freelist;
+    pg->freelist = addr;
+    pg->inuse--;
+    class_live[c]--;
+    live_bytes -= CLASS_SIZE(c);
+    free_count++;
+
+    if (was_full) partial_push(c, idx);
+
+    /* Give empty slabs back to the page pool, but keep the last one of
+     * each class around so alloc/free pairs don't thrash the page search */
+    if (pg->inuse == 0 && (pg->next != NO_PAGE || pg->prev != NO_PAGE)) {
+        partial_unlink(c, idx);
+        class_slabs[c]--;
+        heap_release_pages(idx, 1);
+    }
+}
+
+/* Processes are preempted and interrupt handlers allocate too, so the
+ * heap is only ever changed with interrupts off */
+static u32 heap_alloc(u32 size, int align) {
+    if (align == 1 || size > KMALLOC_MAX_SMALL) {
+        /* Page aligned or large: hand out whole pages */
+        u32 pages = (size + KHEAP_PAGE_SIZE - 1) / KHEAP_PAGE_SIZE;
+        u32 idx = heap_alloc_pages(pages);
+        if (idx == NO_PAGE) return 0;
+        live_bytes += pages * KHEAP_PAGE_SIZE;
+        return PAGE_ADDR(idx);
+    }
+    return slab_alloc(size_to_class(size));
+}
 
-/* Implementation is just a pointer to some free memory which
- * keeps growing */
 u32 kmalloc(u32 size, int align, u32 *phys_addr) {
-    /* Pages are aligned to 4K, or 0x1000 */
-    if (align == 1 && (free_mem_addr & 0xFFFFF000)) {
-        free_mem_addr &= 0xFFFFF000;
-        free_mem_addr += 0x1000;
+    if (size == 0) return 0;
+
+    u32 flags = irq_save();
+    u32 ret = heap_alloc(size, align);
+    if (!ret) {
+        irq_restore(flags);
+        return 0;
     }
-    /* Save also the physical address */
-    if (phys_addr) *phys_addr = free_mem_addr;
 
-    u32 ret = free_mem_addr;
-    free_mem_addr += size; /* Remember to increment the pointer */
+    /* Save also the physical address */
+    if (phys_addr) *phys_addr = ret;
 
     /* Track memory statistics */
     total_allocated += size;
@@ -43,20 +260,66 @@ u32 kmalloc(u32 size, int align, u32 *phys_addr) {
     if (size > max_allocation) {
         max_allocation = size;
     }
+    irq_restore(flags);
 
     return ret;
 }
 
+void kfree(u32 addr) {
+    if (!heap_npages || addr < heap_base || addr >= PAGE_ADDR(heap_npages)) return;
+
+    u32 idx = (addr - heap_base) / KHEAP_PAGE_SIZE;
+    heap_page_t *pg = &heap_pages[idx];
+
+    u32 flags = irq_save();
+    if (pg->kind == PAGE_SLAB) {
+        slab_free(idx, addr);
+    } else if (pg->kind == PAGE_SPAN && addr == PAGE_ADDR(idx)) {
+        u32 pages = pg->span_pages;
+        live_bytes -= pages * KHEAP_PAGE_SIZE;
+        free_count++;
+        heap_release_pages(idx, pages);
+    }
+    irq_restore(flags);
+}
+
 /* Get memory statistics */
-void get_memory_stats(u32 *total, u32 *count, u32 *max) {
-    if (total) *total = total_allocated;
-    if (count) *count = allocation_count;
-    if (max) *max = max_allocation;
+void get_memory_stats(memory_stats_t *stats) {
+    if (!stats) return;
+
+    stats->total_allocated = total_allocated;
+    stats->allocation_count = allocation_count;
+    stats->free_count = free_count;
+    stats->max_allocation = max_allocation;
+    stats->live_bytes = live_bytes;
+    stats->total_pages = heap_npages;
+    stats->free_pages = heap_free_pages;
+    stats->committed_bytes = (heap_npages - heap_free_pages) * KHEAP_PAGE_SIZE;
+
+    u32 run = 0, best = 0;
+    for (u32 i = 0; i < heap_npages; i++) {
+        run = (heap_pages[i].kind == PAGE_FREE) ? run + 1 : 0;
+        if (run > best) best = run;
+    }
+    stats->largest_free_run = best;
+
+    stats->fragmentation = 0;
+    if (stats->committed_bytes > 0) {
+        stats->fragmentation = ((stats->committed_bytes - live_bytes) * 100)
+                               / stats->committed_bytes;
+    }
+
+    for (int c = 0; c < KMALLOC_NUM_CLASSES; c++) {
+        stats->class_size[c] = CLASS_SIZE(c);
+        stats->class_live[c] = class_live[c];
+        stats->class_capacity[c] = class_slabs[c] * (KHEAP_PAGE_SIZE / CLASS_SIZE(c));
+    }
 }
 
-/* Reset memory statistics */
+/* Reset cumulative statistics (live accounting is left alone) */
 void reset_memory_stats(void) {
     total_allocated = 0;
     allocation_count = 0;
+    free_count = 0;
     max_allocation = 0;
 }
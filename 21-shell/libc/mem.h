@@ -6,11 +6,42 @@
 void memory_copy(u8 *source, u8 *dest, int nbytes);
 void memory_set(u8 *dest, u8 val, u32 len);
 
-/* At this stage there is no 'free' implemented. */
+/* Kernel heap geometry. Small requests are served from per-size-class
+ * slabs (one 4K page each), anything bigger than the largest class
+ * gets a run of whole pages (a 'span'). The arena itself is carved out
+ * of physical memory by the frame allocator at boot, so init_pmm()
+ * must run first. */
+#define KHEAP_PAGE_SIZE    0x1000
+#define KHEAP_MAX_PAGES    1024  /* 4MB arena when RAM allows */
+#define KHEAP_MIN_PAGES    16
+#define KMALLOC_MIN_SIZE   16
+#define KMALLOC_MAX_SMALL  2048
+#define KMALLOC_NUM_CLASSES 8   /* 16, 32, 64, ..., 2048 */
+
+/* 'align' = 1 returns a page aligned block. Returns 0 when out of memory */
 u32 kmalloc(u32 size, int align, u32 *phys_addr);
+/* Pointers not returned by kmalloc are ignored */
+void kfree(u32 addr);
+void init_kernel_heap(void);
+
+/* Memory statistics */
+typedef struct {
+    u32 total_allocated;    /* Bytes handed out since boot (cumulative) */
+    u32 allocation_count;   /* kmalloc calls that succeeded */
+    u32 free_count;         /* kfree calls that released a block */
+    u32 max_allocation;     /* Largest single request */
+    u32 live_bytes;         /* Bytes in blocks currently allocated */
+    u32 committed_bytes;    /* Bytes of heap pages backing slabs and spans */
+    u32 total_pages;
+    u32 free_pages;
+    u32 largest_free_run;   /* In pages, bounds the biggest possible span */
+    u32 fragmentation;      /* % of committed bytes not holding live blocks */
+    u32 class_size[KMALLOC_NUM_CLASSES];
+    u32 class_live[KMALLOC_NUM_CLASSES];     /* Objects in use */
+    u32 class_capacity[KMALLOC_NUM_CLASSES]; /* Objects in all slabs */
+} memory_stats_t;
 
-/* Memory statistics functions */
-void get_memory_stats(u32 *total, u32 *count, u32 *max);
+void get_memory_stats(memory_stats_t *stats);
 void reset_memory_stats(void);
 
 #endif
@@ -98,17 +98,23 @@ echo
 
 # Test 8: Check process switching
 echo "Test 8: Process Switching"
-if grep -q "switch_to_process" cpu/process_switch.asm; then
+if grep -q "schedule_from_irq" cpu/isr_stubs_simple.asm; then
     echo "✓ Process switching assembly implemented"
 else
     echo "✗ Process switching assembly missing"
 fi
 
-if grep -q "save_process_state" cpu/process_switch.asm; then
+if grep -q "proc->context" cpu/process_switch.c; then
     echo "✓ Process state saving implemented"
 else
     echo "✗ Process state saving missing"
 fi
+
+if grep -q "scheduler_tick" cpu/timer.c; then
+    echo "✓ Timer drives preemption"
+else
+    echo "✗ Timer does not drive preemption"
+fi
 echo
 
 # Test 9: Check memory protection
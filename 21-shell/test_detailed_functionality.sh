@@ -103,10 +103,10 @@ echo
 # Test 11: Check process switching
 echo "Test 11: Process Switching Analysis"
 echo "Assembly functions:"
-grep -n "global\|extern" cpu/process_switch.asm
+grep -n "schedule_from_irq\|irq_resume" cpu/isr_stubs_simple.asm
 echo
 echo "Register saving:"
-grep -n "mov.*\[eax" cpu/process_switch.asm
+grep -n "proc->context\|context = esp" cpu/process_switch.c
 echo
 
 # Test 12: Check header dependencies
@@ -162,7 +162,8 @@ echo "Process structure:"
 grep -A 10 "typedef struct" kernel/process.h
 echo
 echo "Process constants:"
-grep -n "MAX_PROCESSES\|next_pid" kernel/process.h
+grep -n "PROCESS_TABLE_LIMIT" kernel/process.h
+grep -n "assign_pid" kernel/process.c
 echo
 
 # Test 18: Check ISR system
@@ -177,7 +178,7 @@ echo
 # Test 19: Check assembly integration
 echo "Test 19: Assembly Integration Analysis"
 echo "Process switch functions:"
-grep -n "global\|extern" cpu/process_switch.asm
+grep -n "schedule_from_irq\|irq_resume" cpu/isr_stubs_simple.asm
 echo
 echo "GDT flush function:"
 grep -n "global\|extern" cpu/gdt_flush.asm
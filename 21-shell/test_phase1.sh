@@ -122,10 +122,10 @@ else
     exit 1
 fi
 
-if [ -f "cpu/process_switch.asm" ]; then
-    echo "✅ cpu/process_switch.asm exists"
+if [ -f "cpu/process_switch.c" ]; then
+    echo "✅ cpu/process_switch.c exists"
 else
-    echo "❌ cpu/process_switch.asm missing"
+    echo "❌ cpu/process_switch.c missing"
     exit 1
 fi
 
@@ -187,10 +187,10 @@ else
     exit 1
 fi
 
-if grep -q "MAX_PROCESSES" kernel/process.h; then
-    echo "✅ MAX_PROCESSES defined"
+if grep -q "PROCESS_TABLE_LIMIT" kernel/process.h; then
+    echo "✅ PROCESS_TABLE_LIMIT defined"
 else
-    echo "❌ MAX_PROCESSES not defined"
+    echo "❌ PROCESS_TABLE_LIMIT not defined"
     exit 1
 fi
 
@@ -248,17 +248,17 @@ fi
 echo ""
 echo "Test 14: Assembly Integration"
 echo "---------------------------"
-if grep -q "switch_to_process" cpu/process_switch.asm; then
-    echo "✅ switch_to_process in assembly"
+if grep -q "schedule_from_irq" cpu/isr_stubs_simple.asm; then
+    echo "✅ schedule_from_irq called from the IRQ stub"
 else
-    echo "❌ switch_to_process not in assembly"
+    echo "❌ schedule_from_irq not called from the IRQ stub"
     exit 1
 fi
 
-if grep -q "save_process_state" cpu/process_switch.asm; then
-    echo "✅ save_process_state in assembly"
+if grep -q "proc->context" cpu/process_switch.c; then
+    echo "✅ Process state saved in proc->context"
 else
-    echo "❌ save_process_state not in assembly"
+    echo "❌ Process state not saved in proc->context"
     exit 1
 fi
 